@@ -0,0 +1,359 @@
+#include <iostream>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost\thread.hpp>
+#include <boost\atomic.hpp>
+#include <boost\chrono\chrono.hpp>
+
+#include "BoundedQueue.h"
+#include "ThreadPool.h"
+
+// standalone driver, build it (with the pool sources) instead of main.cpp
+// every result is one line "benchmark workers producers metric value", so runs before and after a
+// change can be diffed or loaded as a table; pass section names (queue throughput latency kill spawn)
+// to run only some of them
+
+using namespace std;
+
+void report(const string& benchmark, int workers, int producers, const string& metric, double value)
+{
+    cout << benchmark << " " << workers << " " << producers << " " << metric << " " << (long long)value << endl;
+}
+
+class LockedQueue
+{
+public:
+
+    bool push(unsigned val)
+    {
+        boost::mutex::scoped_lock lock(sync);
+
+        items.push_back(val);
+
+        return true;
+    }
+
+    bool pop(unsigned& val)
+    {
+        boost::mutex::scoped_lock lock(sync);
+
+        if (items.empty())
+        {
+            return false;
+        }
+
+        val = items.front();
+        items.pop_front();
+
+        return true;
+    }
+
+private:
+    deque<unsigned> items;
+    boost::mutex sync;
+};
+
+template <typename Queue>
+double measure(Queue& queue, int producers, int consumers, unsigned per_producer)
+{
+    boost::atomic<unsigned> consumed(0);
+    boost::atomic<bool> go(false);
+
+    unsigned total = per_producer * producers;
+
+    boost::thread_group threads;
+
+    for (int i = 0; i < consumers; ++i)
+    {
+        threads.create_thread([&] {
+            while (!go) {}
+
+            unsigned val;
+
+            while (consumed < total)
+            {
+                if (queue.pop(val))
+                {
+                    ++consumed;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < producers; ++i)
+    {
+        threads.create_thread([&] {
+            while (!go) {}
+
+            for (unsigned j = 0; j < per_producer; ++j)
+            {
+                while (!queue.push(j))
+                {
+                    boost::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    auto start = boost::chrono::steady_clock::now();
+
+    go = true;
+
+    threads.join_all();
+
+    boost::chrono::duration<double> elapsed = boost::chrono::steady_clock::now() - start;
+
+    return total / elapsed.count();
+}
+
+void queue_benchmarks()
+{
+    const int consumers = 4;
+    const unsigned operations = 1 << 21;
+
+    for (int producers = 1; producers <= 64; producers *= 2)
+    {
+        unsigned per_producer = operations / producers;
+
+        BoundedQueue<unsigned> lock_free(4096);
+        LockedQueue locked;
+
+        report("queue.bounded", consumers, producers, "ops_per_sec", measure(lock_free, producers, consumers, per_producer));
+        report("queue.locked", consumers, producers, "ops_per_sec", measure(locked, producers, consumers, per_producer));
+    }
+}
+
+boost::atomic<unsigned> finished(0);
+
+class Empty : public Callable
+{
+public:
+    int operator() ()
+    {
+        ++finished;
+
+        return 0;
+    }
+};
+
+// hot threads only, so the numbers are about the scheduling path and not about spawning
+ThreadPool::Policy hot_only()
+{
+    ThreadPool::Policy policy;
+
+    policy.maxFreeThreads = 0;
+
+    return policy;
+}
+
+void wait_for(unsigned count)
+{
+    while (finished < count)
+    {
+        boost::this_thread::yield();
+    }
+}
+
+// addTask until every task has run, N producers at once
+void throughput_benchmarks()
+{
+    const unsigned operations = 1 << 18;
+
+    for (int workers = 1; workers <= 8; workers *= 2)
+    {
+        for (int producers = 1; producers <= 8; producers *= 2)
+        {
+            ThreadPool pool(workers, hot_only());
+
+            ostream discard(nullptr);
+
+            pool.setResultOutput(discard);
+
+            finished = 0;
+
+            unsigned per_producer = operations / producers;
+
+            boost::thread_group threads;
+
+            auto start = boost::chrono::steady_clock::now();
+
+            for (int i = 0; i < producers; ++i)
+            {
+                threads.create_thread([&pool, per_producer] {
+                    for (unsigned j = 0; j < per_producer; ++j)
+                    {
+                        pool.addTask(Empty());
+                    }
+                });
+            }
+
+            threads.join_all();
+
+            wait_for(per_producer * producers);
+
+            boost::chrono::duration<double> elapsed = boost::chrono::steady_clock::now() - start;
+
+            report("addTask", workers, producers, "ops_per_sec", per_producer * producers / elapsed.count());
+        }
+    }
+}
+
+// one empty task at a time: full round trip, and the submit-to-start part of it from the pool's own histogram;
+// once with the default spin-then-park idle strategy, once with workers that park straight away
+void latency_benchmarks()
+{
+    const int operations = 20000;
+
+    for (bool spin : { true, false })
+    {
+        string suffix = spin ? "" : "_parked";
+
+        for (int workers = 1; workers <= 8; workers *= 2)
+        {
+            auto policy = hot_only();
+
+            if (!spin)
+            {
+                policy.spinCount = 0;
+                policy.yieldCount = 0;
+            }
+
+            ThreadPool pool(workers, policy);
+
+            auto start = boost::chrono::steady_clock::now();
+
+            for (int i = 0; i < operations; ++i)
+            {
+                pool.submit([] {}).get();
+            }
+
+            boost::chrono::duration<double, boost::nano> elapsed = boost::chrono::steady_clock::now() - start;
+
+            auto stats = pool.stats();
+
+            report("roundtrip" + suffix, workers, 1, "ns_per_op", elapsed.count() / operations);
+            report("submit_to_start" + suffix, workers, 1, "p50_ns", (double)stats.wait.percentile(50));
+            report("submit_to_start" + suffix, workers, 1, "p99_ns", (double)stats.wait.percentile(99));
+            report("submit_to_start" + suffix, workers, 1, "p999_ns", (double)stats.wait.percentile(99.9));
+        }
+    }
+}
+
+// killing queued tasks while every worker is held up
+void kill_benchmarks()
+{
+    const int operations = 4000; // stays under the shared queue's capacity
+
+    for (int workers = 1; workers <= 8; workers *= 2)
+    {
+        ThreadPool pool(workers, hot_only());
+
+        ostream discard(nullptr);
+
+        pool.setResultOutput(discard);
+
+        boost::atomic<bool> release(false);
+        boost::atomic<int> blocked(0);
+
+        vector<future<void>> blockers;
+
+        for (int i = 0; i < workers; ++i)
+        {
+            blockers.push_back(pool.submit([&release, &blocked] {
+                ++blocked;
+
+                while (!release)
+                {
+                    boost::this_thread::yield();
+                }
+            }));
+        }
+
+        while (blocked < workers)
+        {
+            boost::this_thread::yield();
+        }
+
+        vector<ThreadPool::TaskId> ids;
+
+        for (int i = 0; i < operations; ++i)
+        {
+            ids.push_back(pool.addTask(Empty()));
+        }
+
+        auto start = boost::chrono::steady_clock::now();
+
+        for (auto id : ids)
+        {
+            pool.killTask(id);
+        }
+
+        boost::chrono::duration<double, boost::nano> elapsed = boost::chrono::steady_clock::now() - start;
+
+        release = true;
+
+        for (auto& i : blockers)
+        {
+            i.get();
+        }
+
+        report("killTask", workers, 1, "ns_per_op", elapsed.count() / operations);
+    }
+}
+
+// no hot threads and no idle timeout: every task gets a fresh free thread that is reaped right after
+void spawn_benchmarks()
+{
+    const int operations = 500;
+
+    ThreadPool::Policy policy(0);
+
+    ThreadPool pool(0, policy);
+
+    auto start = boost::chrono::steady_clock::now();
+
+    for (int i = 0; i < operations; ++i)
+    {
+        pool.submit([] {}).get();
+    }
+
+    while (pool.stats().freeThreads > 0)
+    {
+        boost::this_thread::yield();
+    }
+
+    boost::chrono::duration<double, boost::nano> elapsed = boost::chrono::steady_clock::now() - start;
+
+    report("spawn_reap", 0, 1, "ns_per_op", elapsed.count() / operations);
+}
+
+int main(int argc, char** argv)
+{
+    vector<pair<string, void (*)()>> sections = {
+        { "queue", queue_benchmarks },
+        { "throughput", throughput_benchmarks },
+        { "latency", latency_benchmarks },
+        { "kill", kill_benchmarks },
+        { "spawn", spawn_benchmarks },
+    };
+
+    cout << "benchmark workers producers metric value" << endl;
+
+    for (auto& section : sections)
+    {
+        bool selected = argc < 2;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            selected = selected || section.first == argv[i];
+        }
+
+        if (selected)
+        {
+            section.second();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <boost\atomic.hpp>
+#include <boost\noncopyable.hpp>
+
+// bounded multi-producer/multi-consumer queue (D. Vyukov's array queue)
+// every cell carries a sequence number saying whose turn it is, so push and pop
+// are one CAS on their own counter and producers never touch consumers' cache line
+
+template <typename Type>
+class BoundedQueue : boost::noncopyable
+{
+public:
+
+    BoundedQueue(size_t capacity)
+    {
+        size_t size = 2;
+
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        buffer = new Cell[size];
+        mask = size - 1;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            buffer[i].sequence.store(i, boost::memory_order_relaxed);
+        }
+
+        enqueue_pos.store(0, boost::memory_order_relaxed);
+        dequeue_pos.store(0, boost::memory_order_relaxed);
+    }
+
+    ~BoundedQueue()
+    {
+        delete[] buffer;
+    }
+
+    bool push(const Type& val)
+    {
+        Cell* cell;
+        size_t pos = enqueue_pos.load(boost::memory_order_relaxed);
+
+        while (true)
+        {
+            cell = &buffer[pos & mask];
+
+            size_t seq = cell->sequence.load(boost::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = enqueue_pos.load(boost::memory_order_relaxed);
+            }
+        }
+
+        cell->data = val;
+        cell->sequence.store(pos + 1, boost::memory_order_release);
+
+        return true;
+    }
+
+    // all or nothing: claims n consecutive cells with a single CAS
+    bool push(const Type* vals, size_t n)
+    {
+        if (n == 0)
+        {
+            return true;
+        }
+
+        if (n > mask + 1)
+        {
+            return false;
+        }
+
+        size_t pos = enqueue_pos.load(boost::memory_order_relaxed);
+
+        while (true)
+        {
+            bool stale = false;
+
+            for (size_t i = 0; i < n && !stale; ++i)
+            {
+                size_t seq = buffer[(pos + i) & mask].sequence.load(boost::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + i);
+
+                if (diff < 0)
+                {
+                    return false; // not enough room
+                }
+
+                stale = diff > 0;
+            }
+
+            if (stale)
+            {
+                pos = enqueue_pos.load(boost::memory_order_relaxed);
+            }
+            else if (enqueue_pos.compare_exchange_weak(pos, pos + n, boost::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            Cell* cell = &buffer[(pos + i) & mask];
+
+            cell->data = vals[i];
+            cell->sequence.store(pos + i + 1, boost::memory_order_release);
+        }
+
+        return true;
+    }
+
+    bool pop(Type& val)
+    {
+        Cell* cell;
+        size_t pos = dequeue_pos.load(boost::memory_order_relaxed);
+
+        while (true)
+        {
+            cell = &buffer[pos & mask];
+
+            size_t seq = cell->sequence.load(boost::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = dequeue_pos.load(boost::memory_order_relaxed);
+            }
+        }
+
+        val = cell->data;
+        cell->sequence.store(pos + mask + 1, boost::memory_order_release);
+
+        return true;
+    }
+
+    // approximate, exact only when nobody is pushing or popping
+    bool empty() const
+    {
+        return dequeue_pos.load(boost::memory_order_seq_cst) >= enqueue_pos.load(boost::memory_order_seq_cst);
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+
+    static const size_t cacheline = 64;
+
+    struct Cell
+    {
+        boost::atomic<size_t> sequence;
+        Type data;
+    };
+
+    char pad0[cacheline];
+
+    Cell* buffer;
+    size_t mask;
+
+    char pad1[cacheline];
+
+    boost::atomic<size_t> enqueue_pos;
+
+    char pad2[cacheline];
+
+    boost::atomic<size_t> dequeue_pos;
+
+    char pad3[cacheline];
+};
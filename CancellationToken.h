@@ -0,0 +1,32 @@
+#pragma once
+
+#include <boost\atomic.hpp>
+
+// handed to a running task so it can notice killTask (or its pool going away) and return early;
+// asking costs two relaxed loads, nothing is ever interrupted from the outside
+// only meaningful during the run it was handed to, a default constructed token is never cancelled
+
+class CancellationToken
+{
+public:
+
+    CancellationToken() : state(nullptr), live(0), stopping(nullptr) {}
+
+    CancellationToken(const boost::atomic<unsigned long long>* state, unsigned long long live, const boost::atomic<bool>* stopping)
+        :
+        state(state),
+        live(live),
+        stopping(stopping)
+    {}
+
+    bool isCancelled() const
+    {
+        return state != nullptr && (state->load(boost::memory_order_relaxed) != live || stopping->load(boost::memory_order_relaxed));
+    }
+
+private:
+
+    const boost::atomic<unsigned long long>* state; // task record's stamp, moves off live when the task is killed
+    unsigned long long live;
+    const boost::atomic<bool>* stopping;
+};
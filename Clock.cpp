@@ -0,0 +1,316 @@
+#include <algorithm>
+
+#include "Clock.h"
+
+class SystemClock : public Clock
+{
+public:
+
+    virtual long long now()
+    {
+        return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    virtual void sleepUntil(long long deadline)
+    {
+        long long left = deadline - now();
+
+        if (left > 0)
+        {
+            boost::this_thread::sleep_for(boost::chrono::nanoseconds(left));
+        }
+    }
+
+    virtual bool wait(EventCount& event, unsigned key, long long deadline)
+    {
+        if (deadline == never)
+        {
+            return event.wait(key, -1);
+        }
+
+        // rounded up, a wait never ends before its deadline
+        long long left = std::max(deadline - now(), 0LL);
+
+        return event.wait(key, (int)std::min((left + 999999) / 1000000, (long long)INT_MAX));
+    }
+};
+
+Clock& Clock::system()
+{
+    static SystemClock clock;
+
+    return clock;
+}
+
+VirtualClock::VirtualClock(long long start)
+    :
+    time(start),
+    participants(0),
+    released(false),
+    sequence(0)
+{
+}
+
+long long VirtualClock::now()
+{
+    return time.load();
+}
+
+void VirtualClock::sleepUntil(long long deadline)
+{
+    boost::unique_lock<boost::mutex> lock(sync);
+
+    if (deadline <= time)
+    {
+        return;
+    }
+
+    Sleeper self;
+
+    self.deadline = deadline;
+    self.event = nullptr;
+    self.key = 0;
+
+    add(self);
+    block(self, lock);
+}
+
+bool VirtualClock::wait(EventCount& event, unsigned key, long long deadline)
+{
+    boost::unique_lock<boost::mutex> lock(sync);
+
+    // the event itself is never slept on, only watched by settle()
+    if (released || event.notifiedSince(key) || deadline <= time)
+    {
+        bool res = released || event.notifiedSince(key);
+
+        lock.unlock();
+
+        event.cancelWait();
+
+        return res;
+    }
+
+    Sleeper self;
+
+    self.deadline = deadline;
+    self.event = &event;
+    self.key = key;
+
+    add(self);
+
+    try
+    {
+        block(self, lock);
+    }
+    catch (...)
+    {
+        lock.unlock();
+
+        event.cancelWait();
+
+        throw;
+    }
+
+    bool res = self.notified || released;
+
+    lock.unlock();
+
+    event.cancelWait();
+
+    return res;
+}
+
+void VirtualClock::enter()
+{
+    boost::mutex::scoped_lock lock(sync);
+
+    ++participants;
+}
+
+void VirtualClock::leave()
+{
+    boost::mutex::scoped_lock lock(sync);
+
+    --participants;
+
+    places.erase(boost::this_thread::get_id());
+
+    changed.notify_all();
+}
+
+void VirtualClock::settle()
+{
+    boost::unique_lock<boost::mutex> lock(sync);
+
+    while (!released)
+    {
+        int asleep = 0;
+        int notified = 0;
+
+        Sleeper* next = nullptr; // earliest to go to sleep among those whose event fired
+
+        for (auto sleeper : sleepers)
+        {
+            if (sleeper->woken)
+            {
+                continue; // on its way out, running already
+            }
+
+            if (sleeper->event != nullptr && sleeper->event->notifiedSince(sleeper->key))
+            {
+                ++notified;
+
+                if (next == nullptr || sleeper->order < next->order)
+                {
+                    next = sleeper;
+                }
+
+                continue;
+            }
+
+            ++asleep;
+        }
+
+        if (asleep + notified < participants)
+        {
+            // somebody still runs; it either goes to sleep or leaves, both of which signal
+            changed.wait_for(lock, boost::chrono::milliseconds(1));
+
+            continue;
+        }
+
+        if (next == nullptr)
+        {
+            return;
+        }
+
+        // notified waiters go one at a time too, whoever takes the work is then always the same thread
+        resume(*next, true);
+    }
+}
+
+void VirtualClock::advance(long long duration)
+{
+    long long target = time + duration;
+
+    settle();
+
+    while (true)
+    {
+        {
+            boost::mutex::scoped_lock lock(sync);
+
+            Sleeper* next = nullptr;
+
+            for (auto sleeper : sleepers)
+            {
+                if (!sleeper->woken && sleeper->deadline <= target
+                    && (next == nullptr || sleeper->deadline < next->deadline || (sleeper->deadline == next->deadline && sleeper->order < next->order)))
+                {
+                    next = sleeper;
+                }
+            }
+
+            if (released || next == nullptr)
+            {
+                time = std::max(time.load(), target);
+
+                prune();
+
+                return;
+            }
+
+            time = std::max(time.load(), next->deadline);
+
+            prune();
+
+            resume(*next, false);
+        }
+
+        settle();
+    }
+}
+
+void VirtualClock::release()
+{
+    boost::mutex::scoped_lock lock(sync);
+
+    released = true;
+
+    for (auto sleeper : sleepers)
+    {
+        if (sleeper->event != nullptr)
+        {
+            sleeper->wake.notify_one();
+        }
+    }
+
+    changed.notify_all();
+}
+
+void VirtualClock::add(VirtualClock::Sleeper& sleeper)
+{
+    auto& place = places[boost::this_thread::get_id()];
+
+    if (place.second == 0 || place.first != sleeper.deadline)
+    {
+        place = { sleeper.deadline, ++sequence };
+    }
+
+    sleeper.order = place.second;
+    sleeper.woken = false;
+    sleeper.notified = false;
+
+    sleepers.push_back(&sleeper);
+
+    changed.notify_all();
+}
+
+void VirtualClock::prune()
+{
+    // nobody sleeps until a deadline that has come, those places are done with
+    for (auto place = places.begin(); place != places.end();)
+    {
+        if (place->second.first <= time)
+        {
+            place = places.erase(place);
+        }
+        else
+        {
+            ++place;
+        }
+    }
+}
+
+void VirtualClock::remove(VirtualClock::Sleeper& sleeper)
+{
+    sleepers.erase(std::find(sleepers.begin(), sleepers.end(), &sleeper));
+}
+
+void VirtualClock::block(VirtualClock::Sleeper& sleeper, boost::unique_lock<boost::mutex>& lock)
+{
+    try
+    {
+        while (!sleeper.woken && !(released && sleeper.event != nullptr))
+        {
+            sleeper.wake.wait(lock);
+        }
+    }
+    catch (...)
+    {
+        remove(sleeper);
+
+        throw;
+    }
+
+    remove(sleeper);
+}
+
+void VirtualClock::resume(VirtualClock::Sleeper& sleeper, bool notified)
+{
+    sleeper.woken = true;
+    sleeper.notified = notified;
+
+    sleeper.wake.notify_one();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <climits>
+#include <map>
+#include <vector>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+#include "EventCount.h"
+
+// where the pool takes its time from and how its threads wait for it to pass; ns on a steady timeline
+// the system clock is the real one, tests hand the pool a VirtualClock instead
+
+class Clock : boost::noncopyable
+{
+public:
+
+    static const long long never = LLONG_MAX;
+
+    virtual ~Clock() {}
+
+    virtual long long now() = 0;
+
+    // calling thread only; an interruption point, like boost::this_thread::sleep_for
+    virtual void sleepUntil(long long deadline) = 0;
+
+    // after event.prepareWait(): true once the event is notified, false when the deadline passes first
+    virtual bool wait(EventCount& event, unsigned key, long long deadline) = 0;
+
+    // a thread that will wait through this clock came / went; only a virtual clock keeps count
+    virtual void enter() {}
+    virtual void leave() {}
+
+    void sleepFor(long long duration) { sleepUntil(now() + duration); }
+
+    static Clock& system();
+};
+
+// time that moves only when the driver says so
+// every thread that may run pool code enters the clock; once all of them wait on it (or on an
+// event nobody notified) the system is settled and the driver may act. time then advances to one
+// due deadline at a time, waking one thread at a time in the order they went to sleep, so the same
+// actions always replay the same way, in no more real time than the work itself takes
+
+class VirtualClock : public Clock
+{
+public:
+
+    // starts well away from zero, so "long ago" defaults (0) stay long ago
+    VirtualClock(long long start = 1LL << 40);
+
+    virtual long long now();
+    virtual void sleepUntil(long long deadline);
+    virtual bool wait(EventCount& event, unsigned key, long long deadline);
+    virtual void enter();
+    virtual void leave();
+
+    // real time, until every thread that entered is asleep with nothing due
+    void settle();
+
+    // settles after each deadline due within duration, then leaves the time at now + duration
+    void advance(long long duration);
+
+    // for tearing the system down: waits on events return at once from here on, sleeps last
+    // until the sleeping thread is interrupted, so whatever still runs ends the same way every time
+    void release();
+
+private:
+
+    struct Sleeper
+    {
+        long long deadline;
+        unsigned long long order;
+
+        EventCount* event; // nullptr - plain sleep
+        unsigned key;
+
+        bool woken;
+        bool notified; // woken by its event rather than by time
+
+        boost::condition_variable wake;
+    };
+
+    void add(Sleeper& sleeper);
+    void remove(Sleeper& sleeper);
+    void prune();
+    void block(Sleeper& sleeper, boost::unique_lock<boost::mutex>& lock);
+    void resume(Sleeper& sleeper, bool notified);
+
+    boost::atomic<long long> time;
+
+    int participants;
+    bool released;
+
+    unsigned long long sequence;
+
+    // a thread that sleeps again until the same deadline (say after a notify that wasn't for it) keeps its place;
+    // kept until the deadline comes or the thread leaves
+    std::map<boost::thread::id, std::pair<long long, unsigned long long>> places;
+
+    std::vector<Sleeper*> sleepers;
+
+    boost::mutex sync;
+    boost::condition_variable changed;
+};
@@ -0,0 +1,168 @@
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <charconv>
+#include <climits>
+#include <cstring>
+
+#include "CommandReader.h"
+
+CommandReader::CommandReader(int fd, size_t capacity)
+    :
+    fd(fd),
+    buffer(capacity),
+    begin(0),
+    end(0),
+    finished(false),
+    overlong(false)
+{
+}
+
+size_t CommandReader::read(Command* out, size_t max)
+{
+    size_t n = 0;
+
+    while (n < max)
+    {
+        const char* line = buffer.data() + begin;
+        const char* newline = (const char*)memchr(line, '\n', end - begin);
+
+        if (newline == nullptr)
+        {
+            if (finished)
+            {
+                // last line without a newline
+                if (begin < end && !overlong && parse(line, buffer.data() + end, out[n]))
+                {
+                    ++n;
+                }
+
+                begin = end;
+
+                return n;
+            }
+
+            // whatever is parsed goes out now, a caller with commands in hand doesn't wait for more input
+            if (n > 0)
+            {
+                return n;
+            }
+
+            fill();
+
+            continue;
+        }
+
+        if (!overlong && parse(line, newline, out[n]))
+        {
+            ++n;
+        }
+
+        overlong = false;
+
+        begin = newline + 1 - buffer.data();
+    }
+
+    return n;
+}
+
+bool CommandReader::parse(const char* begin, const char* end, Command& command)
+{
+    if (end > begin && end[-1] == '\r')
+    {
+        --end;
+    }
+
+    // trailing spaces are fine, anything else after the command is not
+    while (end > begin && end[-1] == ' ')
+    {
+        --end;
+    }
+
+    const char* space = (const char*)memchr(begin, ' ', end - begin);
+    const char* word = space == nullptr ? end : space;
+
+    size_t length = word - begin;
+
+    if (length == 4 && memcmp(begin, "exit", 4) == 0)
+    {
+        command.kind = Command::EXIT;
+        command.value = 0;
+
+        return word == end;
+    }
+
+    if (length == 3 && memcmp(begin, "add", 3) == 0)
+    {
+        command.kind = Command::ADD;
+    }
+    else if (length == 4 && memcmp(begin, "kill", 4) == 0)
+    {
+        command.kind = Command::KILL;
+    }
+    else
+    {
+        return false;
+    }
+
+    const char* number = word;
+
+    while (number < end && *number == ' ')
+    {
+        ++number;
+    }
+
+    auto res = std::from_chars(number, end, command.value);
+
+    // the whole rest of the line is the number: "add 12abc" is junk, not 12
+    if (res.ec != std::errc() || res.ptr == number || res.ptr != end)
+    {
+        return false;
+    }
+
+    // a duration is seconds in an unsigned, a bigger one would wrap around to some other task
+    return command.kind != Command::ADD || command.value <= UINT_MAX;
+}
+
+void CommandReader::fill()
+{
+    // the unparsed tail moves to the front, the read goes after it
+    if (begin > 0)
+    {
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+
+        end -= begin;
+        begin = 0;
+    }
+
+    if (end == buffer.size())
+    {
+        // a single line fills the whole buffer: it is dropped up to its newline
+        overlong = true;
+        end = 0;
+    }
+
+#ifdef _WIN32
+    int got = _read(fd, buffer.data() + end, (unsigned)(buffer.size() - end));
+#else
+    ssize_t got;
+
+    do
+    {
+        got = ::read(fd, buffer.data() + end, buffer.size() - end);
+    } while (got < 0 && errno == EINTR);
+#endif
+
+    if (got <= 0)
+    {
+        finished = true;
+    }
+    else
+    {
+        end += got;
+    }
+}
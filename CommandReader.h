@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <boost\noncopyable.hpp>
+
+// front end commands, one per line: "add <seconds>", "kill <task id>", "exit"
+// the descriptor is read in big chunks (whatever it has, never waiting for a full buffer) and the
+// complete lines are parsed in place with from_chars; no strings, no tokens, nothing allocated per command
+
+struct Command
+{
+    typedef enum {
+        ADD,
+        KILL,
+        EXIT,
+    } KindT;
+
+    KindT kind;
+    unsigned long long value; // add - duration, kill - task id
+};
+
+class CommandReader : boost::noncopyable
+{
+public:
+
+    static const size_t defaultCapacity = 1 << 16;
+
+    CommandReader(int fd, size_t capacity = defaultCapacity);
+
+    // every complete command already read, up to max; blocks only while there is none
+    // 0 - end of input. lines that don't parse (trailing junk or an add over UINT_MAX included) or don't fit in
+    // the buffer are skipped
+    size_t read(Command* out, size_t max);
+
+private:
+
+    static bool parse(const char* begin, const char* end, Command& command);
+
+    void fill();
+
+    int fd;
+
+    std::vector<char> buffer;
+    size_t begin; // first byte not parsed yet
+    size_t end;   // past the last byte read
+
+    bool finished;
+    bool overlong; // dropping the rest of a line longer than the buffer
+};
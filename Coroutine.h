@@ -0,0 +1,210 @@
+#pragma once
+
+// C++20 coroutines on top of the pool, compiled only where the language has them
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#define COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <utility>
+
+#include "ThreadPool.h"
+
+// lazy coroutine: starts when awaited, and when it finishes it resumes its awaiter straight away
+// (symmetric transfer), so a chain of awaits never blocks a thread or grows the stack
+
+template <typename T>
+class CoTask;
+
+struct CoPromiseBase
+{
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        coroutine_handle<> await_suspend(coroutine_handle<Promise> handle) noexcept
+        {
+            auto continuation = handle.promise().continuation;
+
+            return continuation ? continuation : noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = current_exception(); }
+
+    coroutine_handle<> continuation;
+    exception_ptr error;
+};
+
+template <typename T>
+struct CoPromise : CoPromiseBase
+{
+    CoTask<T> get_return_object();
+
+    template <typename V>
+    void return_value(V&& v) { value.emplace(std::forward<V>(v)); }
+
+    T result()
+    {
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+
+        return std::move(*value);
+    }
+
+    optional<T> value;
+};
+
+template <>
+struct CoPromise<void> : CoPromiseBase
+{
+    CoTask<void> get_return_object();
+
+    void return_void() {}
+
+    void result()
+    {
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+    }
+};
+
+template <typename T>
+class CoTask
+{
+public:
+
+    typedef CoPromise<T> promise_type;
+
+    explicit CoTask(coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    CoTask(CoTask&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    CoTask& operator=(CoTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+            {
+                handle.destroy();
+            }
+
+            handle = std::exchange(other.handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+
+    ~CoTask()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+
+            coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation = awaiting;
+
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+        };
+
+        return Awaiter{ handle };
+    }
+
+private:
+
+    coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+CoTask<T> CoPromise<T>::get_return_object()
+{
+    return CoTask<T>(coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object()
+{
+    return CoTask<void>(coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+// eager, self-destroying coroutine used to hand a CoTask's outcome to ordinary code
+struct CoDetached
+{
+    struct promise_type
+    {
+        CoDetached get_return_object() { return {}; }
+
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+template <typename T>
+CoDetached co_drive(CoTask<T> task, promise<T> result)
+{
+    try
+    {
+        if constexpr (is_void<T>::value)
+        {
+            co_await std::move(task);
+
+            result.set_value();
+        }
+        else
+        {
+            result.set_value(co_await std::move(task));
+        }
+    }
+    catch (...)
+    {
+        result.set_exception(current_exception());
+    }
+}
+
+// runs the task on the calling thread up to its first suspension; the future is the bridge back
+template <typename T>
+future<T> start_task(CoTask<T> task)
+{
+    promise<T> result;
+
+    auto res = result.get_future();
+
+    co_drive(std::move(task), std::move(result));
+
+    return res;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#pragma comment(lib, "synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#endif
+
+#include <climits>
+#include <algorithm>
+
+#include "EventCount.h"
+
+static_assert(sizeof(boost::atomic<unsigned>) == sizeof(unsigned), "futex word must be a plain 32-bit integer");
+
+static long long now_ms()
+{
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if defined(_WIN32)
+
+// false on timeout
+static bool block(boost::atomic<unsigned>& word, unsigned key, int timeout)
+{
+    return WaitOnAddress(&word, &key, sizeof(key), timeout < 0 ? INFINITE : (DWORD)timeout) || GetLastError() != ERROR_TIMEOUT;
+}
+
+static void wake(boost::atomic<unsigned>& word, int n)
+{
+    if (n == INT_MAX)
+    {
+        WakeByAddressAll(&word);
+
+        return;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        WakeByAddressSingle(&word);
+    }
+}
+
+#elif defined(__linux__)
+
+static bool block(boost::atomic<unsigned>& word, unsigned key, int timeout)
+{
+    timespec relative = { timeout / 1000, (long)(timeout % 1000) * 1000000 };
+
+    // EAGAIN (word already moved on) and EINTR both just send the caller back to check its key
+    return syscall(SYS_futex, reinterpret_cast<unsigned*>(&word), FUTEX_WAIT_PRIVATE, key, timeout < 0 ? nullptr : &relative, nullptr, 0) == 0 || errno != ETIMEDOUT;
+}
+
+static void wake(boost::atomic<unsigned>& word, int n)
+{
+    syscall(SYS_futex, reinterpret_cast<unsigned*>(&word), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
+#endif
+
+unsigned EventCount::prepareWait()
+{
+    // the increment is a full barrier: either the notifier sees us waiting, or we see what it published
+    ++waiting;
+
+    return epoch.load();
+}
+
+void EventCount::cancelWait()
+{
+    --waiting;
+}
+
+bool EventCount::wait(unsigned key, int timeout)
+{
+    long long deadline = timeout < 0 ? 0 : now_ms() + timeout;
+
+    bool res = true;
+
+#if defined(_WIN32) || defined(__linux__)
+    while (epoch.load() == key)
+    {
+        int left = timeout < 0 ? -1 : (int)std::max(deadline - now_ms(), 0LL);
+
+        if (!block(epoch, key, left) && epoch.load() == key)
+        {
+            res = false;
+
+            break;
+        }
+    }
+#else
+    boost::unique_lock<boost::mutex> lock(sync);
+
+    while (epoch.load() == key && res)
+    {
+        if (timeout < 0)
+        {
+            changed.wait(lock);
+        }
+        else
+        {
+            res = changed.wait_until(lock, boost::chrono::steady_clock::time_point(boost::chrono::milliseconds(deadline))) == boost::cv_status::no_timeout || epoch.load() != key;
+        }
+    }
+#endif
+
+    --waiting;
+
+    return res;
+}
+
+void EventCount::notify(int n)
+{
+    // pairs with the increment in prepareWait
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+    if (n <= 0 || waiting.load(boost::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+
+    ++epoch;
+
+#if defined(_WIN32) || defined(__linux__)
+    wake(epoch, n);
+#else
+    boost::mutex::scoped_lock lock(sync);
+
+    if (n == INT_MAX)
+    {
+        changed.notify_all();
+    }
+    else
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            changed.notify_one();
+        }
+    }
+#endif
+}
+
+void EventCount::notifyAll()
+{
+    notify(INT_MAX);
+}
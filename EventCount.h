@@ -0,0 +1,60 @@
+#pragma once
+
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// lets threads sleep on a condition without a mutex on either side
+// a waiter announces itself with prepareWait(), checks its condition once more and only then blocks;
+// notify() costs a fence and a load while nobody waits, and a futex wake (WakeByAddress on windows)
+// when somebody does
+
+class EventCount : boost::noncopyable
+{
+public:
+
+    EventCount() : epoch(0), waiting(0) {}
+
+    // returns the key to pass to wait(); every prepareWait() needs a wait() or a cancelWait()
+    unsigned prepareWait();
+    void cancelWait();
+
+    // blocks until a notify() that came after prepareWait(); false on timeout
+    // timeout in milliseconds, negative - forever
+    bool wait(unsigned key, int timeout);
+
+    // at least n waiters, or all of them, are woken
+    void notify(int n);
+    void notifyAll();
+
+    int waiters() const { return waiting.load(); }
+
+    // a notify() happened after the prepareWait() that returned key
+    bool notifiedSince(unsigned key) const { return epoch.load() != key; }
+
+private:
+
+    boost::atomic<unsigned> epoch; // futex word, moves on with every notify that found a waiter
+    boost::atomic<int> waiting;
+
+#if !defined(_WIN32) && !defined(__linux__)
+    boost::mutex sync;
+    boost::condition_variable changed;
+#endif
+};
+
+// one spin-wait step, tells the core (and its hyperthread sibling) that we are only polling
+inline void cpu_relax()
+{
+#if defined(_M_IX86) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <boost\atomic.hpp>
+
+// log-bucketed histogram (HDR style): every power of two is split into 8 linear sub-buckets, so any
+// value is kept to within 12.5% over the full 64-bit range at a fixed 4 KB
+
+class Histogram
+{
+public:
+
+    static const unsigned subBits = 3;
+    static const unsigned buckets = (64 - subBits + 1) << subBits;
+
+    Histogram()
+    {
+        for (unsigned i = 0; i < buckets; ++i)
+        {
+            counts[i] = 0;
+        }
+    }
+
+    static unsigned bucket(unsigned long long value)
+    {
+        if (value < (1ull << subBits))
+        {
+            return (unsigned)value;
+        }
+
+        unsigned exponent = 63;
+
+        while ((value >> exponent) == 0)
+        {
+            --exponent;
+        }
+
+        unsigned sub = (unsigned)(value >> (exponent - subBits)) & ((1u << subBits) - 1);
+
+        return ((exponent - subBits + 1) << subBits) + sub;
+    }
+
+    // largest value that lands in the bucket
+    static unsigned long long highest(unsigned index)
+    {
+        if (index < (1u << subBits))
+        {
+            return index;
+        }
+
+        unsigned exponent = (index >> subBits) + subBits - 1;
+        unsigned long long sub = index & ((1u << subBits) - 1);
+
+        unsigned long long low = (1ull << exponent) | (sub << (exponent - subBits));
+
+        return low + (1ull << (exponent - subBits)) - 1;
+    }
+
+    void add(unsigned long long value, unsigned long long n = 1)
+    {
+        counts[bucket(value)] += n;
+    }
+
+    void merge(const Histogram& other)
+    {
+        for (unsigned i = 0; i < buckets; ++i)
+        {
+            counts[i] += other.counts[i];
+        }
+    }
+
+    unsigned long long count() const
+    {
+        unsigned long long res = 0;
+
+        for (unsigned i = 0; i < buckets; ++i)
+        {
+            res += counts[i];
+        }
+
+        return res;
+    }
+
+    // upper edge of the bucket holding the p-th percentile (0..100), 0 when empty
+    unsigned long long percentile(double p) const
+    {
+        unsigned long long total = count();
+
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        unsigned long long rank = (unsigned long long)(p / 100.0 * (total - 1)) + 1;
+        unsigned long long seen = 0;
+
+        for (unsigned i = 0; i < buckets; ++i)
+        {
+            seen += counts[i];
+
+            if (seen >= rank)
+            {
+                return highest(i);
+            }
+        }
+
+        return highest(buckets - 1);
+    }
+
+    unsigned long long operator[](unsigned index) const
+    {
+        return counts[index];
+    }
+
+private:
+
+    unsigned long long counts[buckets];
+};
+
+// same buckets, one writer and any number of readers; the writer does plain relaxed stores,
+// never a locked read-modify-write, so recording costs no more than the owner's own cache line
+class HistogramRecorder
+{
+public:
+
+    HistogramRecorder()
+    {
+        for (unsigned i = 0; i < Histogram::buckets; ++i)
+        {
+            counts[i].store(0, boost::memory_order_relaxed);
+        }
+    }
+
+    // owner only
+    void add(unsigned long long value)
+    {
+        auto& counter = counts[Histogram::bucket(value)];
+
+        counter.store(counter.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+    }
+
+    void snapshot(Histogram& into) const
+    {
+        for (unsigned i = 0; i < Histogram::buckets; ++i)
+        {
+            into.add(Histogram::highest(i), counts[i].load(boost::memory_order_relaxed));
+        }
+    }
+
+private:
+
+    boost::atomic<unsigned long long> counts[Histogram::buckets];
+};
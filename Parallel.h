@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+#include "ThreadPool.h"
+
+// data-parallel loops over a ThreadPool
+// an index range is cut into chunks that the hot threads and the calling thread claim from one
+// counter; each participant folds its chunks into a partial of its own and the partials are
+// combined once at the end, so the loop body itself never touches a shared atomic
+
+typedef enum {
+    STATIC_PARTITION, // one equal share per participant
+    GUIDED_PARTITION, // chunks shrink with what is left: the remainder split twice per participant
+    AUTO_PARTITION,   // fixed chunks, several per participant, to even out uneven iterations
+} Partition;
+
+template <typename T>
+class ParallelLoop : boost::noncopyable
+{
+public:
+
+    ParallelLoop(size_t total, size_t participants, Partition partition, size_t grain, const T& identity)
+        :
+        total(total),
+        participants(participants),
+        partition(partition),
+        grain(grain),
+        identity(identity),
+        next(0),
+        finished(0),
+        failed(false),
+        partials(participants)
+    {
+        if (partition == STATIC_PARTITION)
+        {
+            chunk = max(grain, (total + participants - 1) / participants);
+        }
+        else
+        {
+            chunk = max(grain, total / (participants * 8));
+        }
+    }
+
+    // participant is this caller's own partial slot; fold(first, last, partial) covers [first, last)
+    template <typename Fold>
+    void work(size_t participant, Fold& fold)
+    {
+        T partial = identity;
+
+        size_t done = 0;
+        size_t first, last;
+
+        while (claim(first, last))
+        {
+            if (!failed)
+            {
+                try
+                {
+                    fold(first, last, partial);
+                }
+                catch (...)
+                {
+                    if (!failed.exchange(true))
+                    {
+                        error = current_exception();
+                    }
+                }
+            }
+
+            done += last - first;
+        }
+
+        // a helper that came too late has nothing to publish and must not touch fold
+        if (done == 0)
+        {
+            return;
+        }
+
+        partials[participant].value = std::move(partial);
+        partials[participant].used = true;
+
+        if (finished.fetch_add(done) + done == total)
+        {
+            boost::mutex::scoped_lock lock(sync);
+
+            all_done.notify_all();
+        }
+    }
+
+    // combine must be associative and commutative, chunks are not folded in index order
+    template <typename Combine>
+    T wait(Combine& combine)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(sync);
+
+            all_done.wait(lock, [this] { return finished == total; });
+        }
+
+        if (failed)
+        {
+            rethrow_exception(error);
+        }
+
+        T res = identity;
+
+        for (auto& i : partials)
+        {
+            if (i.used)
+            {
+                res = combine(std::move(res), std::move(i.value));
+            }
+        }
+
+        return res;
+    }
+
+private:
+
+    struct alignas(64) Partial
+    {
+        Partial() : used(false) {}
+
+        T value;
+        bool used;
+    };
+
+    bool claim(size_t& first, size_t& last)
+    {
+        if (partition != GUIDED_PARTITION)
+        {
+            first = next.fetch_add(chunk);
+
+            if (first >= total)
+            {
+                return false;
+            }
+
+            last = min(total, first + chunk);
+
+            return true;
+        }
+
+        first = next.load();
+
+        do
+        {
+            if (first >= total)
+            {
+                return false;
+            }
+
+            last = min(total, first + max(grain, (total - first) / (participants * 2)));
+        } while (!next.compare_exchange_weak(first, last));
+
+        return true;
+    }
+
+    size_t total;
+    size_t participants;
+    Partition partition;
+    size_t grain;
+    size_t chunk;
+    T identity;
+
+    boost::atomic<size_t> next;
+    boost::atomic<size_t> finished;
+
+    boost::atomic<bool> failed;
+    exception_ptr error;
+
+    boost::mutex sync;
+    boost::condition_variable all_done;
+
+    vector<Partial> partials;
+};
+
+// runs fold over [0, total) on the workers idle at the time plus the caller; with none idle the caller
+// runs every chunk itself. the caller never waits for a helper that has not started, so this is safe
+// from inside a pool task as well; helpers share the loop and the body, one that starts late finds
+// nothing left to claim and never calls into it
+template <typename T, typename Fold, typename Combine>
+T parallel_run(ThreadPool& pool, size_t total, const T& identity, Fold fold, Combine combine, Partition partition, size_t grain)
+{
+    if (total == 0)
+    {
+        return identity;
+    }
+
+    grain = max(grain, (size_t)1);
+
+    size_t helpers = min((size_t)pool.workers(), (total + grain - 1) / grain - 1);
+
+    auto loop = make_shared<ParallelLoop<T>>(total, helpers + 1, partition, grain, identity);
+
+    auto body = make_shared<Fold>(std::move(fold));
+
+    auto helper = [loop, body](size_t participant) { return [loop, body, participant] { loop->work(participant, *body); }; };
+
+    vector<decltype(helper(0))> batch;
+
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        batch.push_back(helper(i));
+    }
+
+    // the shares of helpers that found no idle worker are claimed by whoever runs
+    size_t posted = pool.postIdle(batch.begin(), batch.end());
+
+    loop->work(posted, *body);
+
+    return loop->wait(combine);
+}
+
+// body(i) for every i in [begin, end)
+template <typename Index, typename Body>
+void parallel_for(ThreadPool& pool, Index begin, Index end, Body body, Partition partition = AUTO_PARTITION, size_t grain = 1)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    auto fold = [begin, &body](size_t first, size_t last, bool&)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            body(begin + (Index)i);
+        }
+    };
+
+    auto combine = [](bool a, bool) { return a; };
+
+    parallel_run(pool, (size_t)(end - begin), false, fold, combine, partition, grain);
+}
+
+// body(first, last, partial) returns partial with [first, last) folded in; combine(a, b) joins two partials
+template <typename Index, typename T, typename Body, typename Combine>
+T parallel_reduce(ThreadPool& pool, Index begin, Index end, T identity, Body body, Combine combine, Partition partition = AUTO_PARTITION, size_t grain = 1)
+{
+    if (end <= begin)
+    {
+        return identity;
+    }
+
+    auto fold = [begin, &body](size_t first, size_t last, T& partial)
+    {
+        partial = body(begin + (Index)first, begin + (Index)last, std::move(partial));
+    };
+
+    return parallel_run(pool, (size_t)(end - begin), identity, fold, combine, partition, grain);
+}
+
+// one sorted run per participant, then rounds of pairwise merges
+template <typename Iterator, typename Compare = less<>>
+void parallel_sort(ThreadPool& pool, Iterator first, Iterator last, Compare compare = Compare())
+{
+    const size_t cutoff = 4096;
+
+    size_t n = last - first;
+    size_t runs = min((size_t)pool.workers() + 1, n / cutoff);
+
+    if (runs < 2)
+    {
+        sort(first, last, compare);
+
+        return;
+    }
+
+    vector<size_t> bounds(runs + 1);
+
+    for (size_t i = 0; i <= runs; ++i)
+    {
+        bounds[i] = n * i / runs;
+    }
+
+    parallel_for(pool, (size_t)0, runs, [&](size_t i) { sort(first + bounds[i], first + bounds[i + 1], compare); }, STATIC_PARTITION);
+
+    for (size_t width = 1; width < runs; width *= 2)
+    {
+        parallel_for(pool, (size_t)0, (runs + 2 * width - 1) / (2 * width), [&](size_t k)
+        {
+            size_t lo = 2 * width * k;
+            size_t mid = min(lo + width, runs);
+            size_t hi = min(lo + 2 * width, runs);
+
+            if (mid < hi)
+            {
+                inplace_merge(first + bounds[lo], first + bounds[mid], first + bounds[hi], compare);
+            }
+        }, STATIC_PARTITION);
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <ostream>
+#include <boost\noncopyable.hpp>
+
+// buffered writer for task results, used by the reporter thread only
+// text records are "id value\n" formatted with to_chars straight into the buffer; binary records
+// are 12 bytes, the id in 8 and the value in 4 little-endian bytes. either way the stream sees one
+// write per buffer (or per reporter batch), never one per result
+
+class ResultSink : boost::noncopyable
+{
+public:
+
+    typedef enum {
+        TEXT,
+        BINARY,
+    } FormatT;
+
+    static const size_t bufferSize = 1 << 16;
+
+    ResultSink(std::ostream& out, FormatT format = TEXT)
+        :
+        out(&out),
+        format(format),
+        used(0)
+    {
+    }
+
+    ~ResultSink()
+    {
+        flush();
+    }
+
+    void write(unsigned long long id, int value)
+    {
+        if (bufferSize - used < maxRecord)
+        {
+            flush();
+        }
+
+        char* pos = buffer + used;
+
+        if (format == BINARY)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                *pos++ = (char)(id >> (8 * i));
+            }
+
+            for (int i = 0; i < 4; ++i)
+            {
+                *pos++ = (char)((uint32_t)value >> (8 * i));
+            }
+        }
+        else
+        {
+            pos = std::to_chars(pos, buffer + bufferSize, id).ptr;
+            *pos++ = ' ';
+            pos = std::to_chars(pos, buffer + bufferSize, value).ptr;
+            *pos++ = '\n';
+        }
+
+        used = pos - buffer;
+    }
+
+    void flush()
+    {
+        if (used > 0)
+        {
+            out->write(buffer, used);
+            out->flush();
+
+            used = 0;
+        }
+    }
+
+    void reset(std::ostream& out, FormatT format)
+    {
+        flush();
+
+        this->out = &out;
+        this->format = format;
+    }
+
+private:
+
+    static const size_t maxRecord = 20 + 1 + 11 + 1; // widest text record
+
+    std::ostream* out;
+    FormatT format;
+
+    char buffer[bufferSize];
+    size_t used;
+};
@@ -0,0 +1,587 @@
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#include "Server.h"
+
+static void put(std::vector<char>& out, unsigned long long value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out.push_back((char)(value >> (8 * i)));
+    }
+}
+
+static unsigned long long get(const char* in, int bytes)
+{
+    unsigned long long res = 0;
+
+    for (int i = 0; i < bytes; ++i)
+    {
+        res |= (unsigned long long)(unsigned char)in[i] << (8 * i);
+    }
+
+    return res;
+}
+
+// length, type and two fields
+static void frame(std::vector<char>& out, Server::FrameT type, unsigned long long first, unsigned long long second, int secondBytes)
+{
+    put(out, 1 + 8 + secondBytes, 4);
+
+    out.push_back((char)type);
+
+    put(out, first, 8);
+    put(out, second, secondBytes);
+}
+
+Server::Server(ThreadPool& pool, const std::string& path)
+    :
+    pool(pool),
+    path(path),
+    listener(-1),
+    epoll(-1),
+    wake(-1),
+    stopping(false),
+    paused(false),
+    nextKey(2)
+{
+}
+
+Server::~Server()
+{
+    pool.setResultHandler(nullptr);
+
+    for (auto& client : clients)
+    {
+        ::close(client.second.fd);
+    }
+
+    if (listener >= 0)
+    {
+        ::close(listener);
+
+        unlink(path.c_str());
+    }
+
+    if (epoll >= 0)
+    {
+        ::close(epoll);
+    }
+
+    if (wake >= 0)
+    {
+        ::close(wake);
+    }
+}
+
+bool Server::listen()
+{
+    sockaddr_un address = {};
+
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    unlink(path.c_str());
+
+    if (listener < 0 || epoll < 0 || wake < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0)
+    {
+        return false;
+    }
+
+    epoll_event event = {};
+
+    event.events = EPOLLIN;
+
+    event.data.u64 = listenerKey;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+
+    event.data.u64 = wakeKey;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &event);
+
+    pool.setResultHandler([this](const ThreadPool::TaskResult* results, size_t n) { onResults(results, n); });
+
+    return true;
+}
+
+void Server::run()
+{
+    epoll_event events[64];
+
+    while (!stopping)
+    {
+        int n = epoll_wait(epoll, events, 64, -1);
+
+        for (int i = 0; i < n; ++i)
+        {
+            auto key = events[i].data.u64;
+
+            if (key == listenerKey)
+            {
+                accept();
+            }
+            else if (key == wakeKey)
+            {
+                uint64_t count;
+
+                if (read(wake, &count, sizeof(count)) > 0)
+                {
+                    deliver();
+                }
+            }
+            else
+            {
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    receive(key);
+                }
+
+                auto client = clients.find(key);
+
+                if (client != clients.end() && (events[i].events & EPOLLOUT))
+                {
+                    send(key, client->second);
+                }
+            }
+        }
+    }
+
+    pool.setResultHandler(nullptr);
+}
+
+void Server::stop()
+{
+    stopping = true;
+
+    if (wake >= 0)
+    {
+        uint64_t one = 1;
+
+        write(wake, &one, sizeof(one));
+    }
+}
+
+void Server::accept()
+{
+    while (true)
+    {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0 && (errno == EINTR || errno == ECONNABORTED))
+        {
+            continue;
+        }
+
+        if (fd < 0 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM))
+        {
+            // out of descriptors: the connection stays pending, and a level-triggered listener would
+            // report it again right away. it is left alone until one of the clients goes
+            pauseAccepting(true);
+
+            return;
+        }
+
+        if (fd < 0)
+        {
+            return; // nothing more pending
+        }
+
+        auto key = nextKey++;
+
+        epoll_event event = {};
+
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u64 = key;
+
+        epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+
+        auto& client = clients[key];
+
+        client.fd = fd;
+        client.reading = true;
+        client.events = event.events;
+    }
+}
+
+void Server::receive(unsigned long long key)
+{
+    auto found = clients.find(key);
+
+    if (found == clients.end())
+    {
+        return; // closed earlier in the same batch of events
+    }
+
+    auto& client = found->second;
+
+    if (!client.reading)
+    {
+        close(key); // hangup or error with nothing left to read: the other side is gone for good
+
+        return;
+    }
+
+    // one chunk per event: the loop is level-triggered, so anything still waiting is reported again,
+    // and a client that writes faster than we read neither grows its buffer nor holds the loop
+    size_t used = client.in.size();
+
+    client.in.resize(used + 4096);
+
+    ssize_t got;
+
+    do
+    {
+        got = read(client.fd, client.in.data() + used, 4096);
+    }
+    while (got < 0 && errno == EINTR);
+
+    client.in.resize(used + (got > 0 ? got : 0));
+
+    // straight into the client's buffer, frames are parsed where they land
+    bool open = got > 0 || (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+
+    if (!parse(key, client))
+    {
+        batch.clear();
+        tags.clear();
+
+        close(key);
+
+        return;
+    }
+
+    submit(key, client);
+
+    if (!open)
+    {
+        // done sending, maybe not done listening: the results of its tasks still go out
+        client.reading = false;
+        client.in.clear();
+    }
+
+    send(key, client);
+}
+
+bool Server::parse(unsigned long long key, Server::Client& client)
+{
+    size_t pos = 0;
+
+    while (client.in.size() - pos >= 4)
+    {
+        const char* data = client.in.data() + pos;
+
+        size_t size = (size_t)get(data, 4);
+
+        if (size == 0 || size > maxFrame)
+        {
+            return false;
+        }
+
+        if (client.in.size() - pos - 4 < size)
+        {
+            break; // rest of the frame is still on its way
+        }
+
+        const char* body = data + 4;
+
+        switch (body[0])
+        {
+        case ADD:
+            if (size != 1 + 8 + 4)
+            {
+                return false;
+            }
+
+            tags.push_back(get(body + 1, 8));
+            batch.push_back(Timer((unsigned)get(body + 9, 4)));
+
+            break;
+
+        case KILL:
+            if (size != 1 + 8)
+            {
+                return false;
+            }
+
+            // the adds before it go in first, it may well be aimed at one of them
+            submit(key, client);
+
+            kill(key, client, get(body + 1, 8));
+
+            break;
+
+        default:
+            return false;
+        }
+
+        pos += 4 + size;
+    }
+
+    client.in.erase(client.in.begin(), client.in.begin() + pos);
+
+    return true;
+}
+
+void Server::submit(unsigned long long key, Server::Client& client)
+{
+    if (batch.empty())
+    {
+        return;
+    }
+
+    {
+        // held across addTasks, so a result can't come in before its owner is known
+        boost::mutex::scoped_lock lock(sync);
+
+        std::vector<ThreadPool::TaskId> ids;
+
+        try
+        {
+            ids = pool.addTasks(batch.begin(), batch.end());
+        }
+        catch (const std::length_error&)
+        {
+            // every task record is taken: the whole batch is turned down, the client may try again later
+            for (auto tag : tags)
+            {
+                frame(client.out, REJECTED, tag, 0, 0);
+            }
+        }
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            owners[ids[i]] = key;
+
+            client.tasks.insert(ids[i]);
+
+            frame(client.out, ADDED, tags[i], ids[i], 8);
+        }
+    }
+
+    batch.clear();
+    tags.clear();
+}
+
+void Server::send(unsigned long long key, Server::Client& client)
+{
+    size_t sent = 0;
+
+    while (sent < client.out.size())
+    {
+        ssize_t n = ::send(client.fd, client.out.data() + sent, client.out.size() - sent, MSG_NOSIGNAL);
+
+        if (n > 0)
+        {
+            sent += n;
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        else
+        {
+            close(key);
+
+            return;
+        }
+    }
+
+    client.out.erase(client.out.begin(), client.out.begin() + sent);
+
+    if (!client.reading && client.out.empty() && client.tasks.empty())
+    {
+        close(key); // half closed and everything it was owed went out
+
+        return;
+    }
+
+    // EPOLLOUT only while something is left over, a drained client costs no wakeups
+    uint32_t events = client.reading ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u;
+
+    if (!client.out.empty())
+    {
+        events |= EPOLLOUT;
+    }
+
+    watch(key, client, events);
+}
+
+void Server::watch(unsigned long long key, Server::Client& client, uint32_t events)
+{
+    if (events == client.events)
+    {
+        return;
+    }
+
+    epoll_event event = {};
+
+    event.events = events;
+    event.data.u64 = key;
+
+    epoll_ctl(epoll, EPOLL_CTL_MOD, client.fd, &event);
+
+    client.events = events;
+}
+
+void Server::kill(unsigned long long key, Server::Client& client, ThreadPool::TaskId id)
+{
+    boost::mutex::scoped_lock lock(sync);
+
+    auto owner = owners.find(id);
+
+    // someone else's task, or one whose result is already on its way
+    if (owner == owners.end() || owner->second != key)
+    {
+        return;
+    }
+
+    if (pool.killTask(id))
+    {
+        owners.erase(owner); // no result is coming for it
+
+        client.tasks.erase(id);
+    }
+}
+
+void Server::close(unsigned long long key)
+{
+    auto client = clients.find(key);
+
+    if (client == clients.end())
+    {
+        return;
+    }
+
+    if (!client->second.tasks.empty())
+    {
+        // its results have nowhere to go anymore
+        boost::mutex::scoped_lock lock(sync);
+
+        for (auto id : client->second.tasks)
+        {
+            owners.erase(id);
+        }
+    }
+
+    epoll_ctl(epoll, EPOLL_CTL_DEL, client->second.fd, nullptr);
+
+    ::close(client->second.fd);
+
+    clients.erase(client);
+
+    if (paused)
+    {
+        pauseAccepting(false); // a descriptor is free again
+    }
+}
+
+void Server::pauseAccepting(bool pause)
+{
+    epoll_event event = {};
+
+    event.events = pause ? 0 : EPOLLIN;
+    event.data.u64 = listenerKey;
+
+    epoll_ctl(epoll, EPOLL_CTL_MOD, listener, &event);
+
+    paused = pause;
+}
+
+void Server::deliver()
+{
+    std::vector<std::pair<unsigned long long, ThreadPool::TaskResult>> ready;
+
+    {
+        boost::mutex::scoped_lock lock(sync);
+
+        ready.swap(pending);
+    }
+
+    std::vector<unsigned long long> touched;
+
+    for (const auto& result : ready)
+    {
+        auto client = clients.find(result.first);
+
+        if (client == clients.end())
+        {
+            continue; // gone since it added the task
+        }
+
+        client->second.tasks.erase(result.second.task_id);
+
+        if (client->second.out.empty())
+        {
+            touched.push_back(result.first);
+        }
+
+        frame(client->second.out, RESULT, result.second.task_id, (unsigned)result.second.value, 4);
+    }
+
+    // one send per client for the whole batch; clients that were already backed up wait for EPOLLOUT
+    for (auto key : touched)
+    {
+        auto client = clients.find(key);
+
+        if (client != clients.end())
+        {
+            send(key, client->second);
+        }
+    }
+}
+
+void Server::onResults(const ThreadPool::TaskResult* results, size_t n)
+{
+    bool any = false;
+
+    {
+        boost::mutex::scoped_lock lock(sync);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto owner = owners.find(results[i].task_id);
+
+            if (owner == owners.end())
+            {
+                continue; // not added through the server
+            }
+
+            pending.push_back({ owner->second, results[i] });
+
+            owners.erase(owner);
+
+            any = true;
+        }
+    }
+
+    if (any)
+    {
+        uint64_t one = 1;
+
+        write(wake, &one, sizeof(one));
+    }
+}
+
+#endif
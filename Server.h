@@ -0,0 +1,110 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+#include "ThreadPool.h"
+#include "Timer.h"
+
+// unix domain socket front end: any number of local clients share one pool, one epoll loop serves them all
+// frames are a little-endian u32 length (of what follows) and a u8 type:
+//   client -> server  ADD    u64 tag, u32 seconds   answered by ADDED, the tag is the client's own
+//                     KILL   u64 task id
+//   server -> client  ADDED  u64 tag, u64 task id
+//                     RESULT u64 task id, i32 value only ever to the client that added the task
+//                     REJECTED u64 tag             the pool had no room for that add, nothing was queued
+// anything else closes the connection. a KILL only reaches the client's own tasks. a client that shuts
+// down its sending side still gets the results of what it added, the connection closes after the last
+// one. while it runs the server takes over the pool's results
+
+class Server : boost::noncopyable
+{
+public:
+
+    typedef enum {
+        ADD = 1,
+        KILL = 2,
+        ADDED = 3,
+        RESULT = 4,
+        REJECTED = 5,
+    } FrameT;
+
+    Server(ThreadPool& pool, const std::string& path);
+    ~Server();
+
+    // binds the socket (replacing a stale one left at path) and takes over the pool's results
+    bool listen();
+
+    // the event loop, until stop(); results go back to the pool's sink afterwards
+    void run();
+
+    // any thread
+    void stop();
+
+private:
+
+    struct Client
+    {
+        int fd;
+
+        std::vector<char> in;
+        std::vector<char> out;
+
+        bool reading;    // false once the client has shut down its side
+        uint32_t events; // what epoll watches for it
+
+        std::unordered_set<ThreadPool::TaskId> tasks; // added and not reported or killed yet
+    };
+
+    static const unsigned long long listenerKey = 0;
+    static const unsigned long long wakeKey = 1;
+
+    static const size_t maxFrame = 64;
+
+    void accept();
+    void receive(unsigned long long key);
+    bool parse(unsigned long long key, Client& client);
+    void submit(unsigned long long key, Client& client);
+    void send(unsigned long long key, Client& client);
+    void close(unsigned long long key);
+    void pauseAccepting(bool pause);
+    void watch(unsigned long long key, Client& client, uint32_t events);
+    void kill(unsigned long long key, Client& client, ThreadPool::TaskId id);
+    void deliver();
+
+    void onResults(const ThreadPool::TaskResult* results, size_t n);
+
+    ThreadPool& pool;
+    std::string path;
+
+    int listener;
+    int epoll;
+    int wake; // eventfd, the reporter thread pokes it when results are in
+
+    boost::atomic<bool> stopping;
+
+    bool paused; // out of descriptors, the listener isn't watched until a client closes
+
+    // keys never repeat, a result can't end up with a newer client that got the same descriptor
+    std::unordered_map<unsigned long long, Client> clients;
+    unsigned long long nextKey;
+
+    // adds waiting for the end of the current read, so they go in as one batch
+    std::vector<Timer> batch;
+    std::vector<unsigned long long> tags;
+
+    // task id -> client key, and results on their way from the reporter thread to the loop
+    std::unordered_map<ThreadPool::TaskId, unsigned long long> owners;
+    std::vector<std::pair<unsigned long long, ThreadPool::TaskResult>> pending;
+    boost::mutex sync;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+// chunked object pool addressed by index
+// objects are never destroyed while the slab lives, freed indices go to a lock-free stack
+// (tagged head against ABA) and are handed out again before any new chunk is allocated
+// at most capacity objects live at once, past that allocations fail
+
+template <typename Type>
+class Slab : boost::noncopyable
+{
+public:
+
+    static const unsigned chunkBits = 10;
+    static const unsigned chunkSize = 1 << chunkBits;
+    static const unsigned maxChunks = 4096;
+    static const unsigned capacity = maxChunks * chunkSize;
+
+    static const unsigned none = ~0u; // allocate() with every index taken
+
+    Slab()
+        :
+        head(0),
+        used(0),
+        chunkAllocations(0)
+    {
+        for (unsigned i = 0; i < maxChunks; ++i)
+        {
+            chunks[i].store(nullptr, boost::memory_order_relaxed);
+        }
+    }
+
+    ~Slab()
+    {
+        for (unsigned i = 0; i < maxChunks; ++i)
+        {
+            delete[] chunks[i].load(boost::memory_order_relaxed);
+        }
+    }
+
+    unsigned allocate()
+    {
+        uint64_t current = head.load(boost::memory_order_acquire);
+
+        while ((current & 0xffffffff) != 0)
+        {
+            unsigned index = (unsigned)(current & 0xffffffff) - 1;
+            uint64_t next = ((current >> 32) + 1) << 32 | slot(index).next.load(boost::memory_order_relaxed);
+
+            if (head.compare_exchange_weak(current, next, boost::memory_order_acquire))
+            {
+                return index;
+            }
+        }
+
+        unsigned index;
+
+        if (!claim(1, index))
+        {
+            return none;
+        }
+
+        if (chunks[index >> chunkBits].load(boost::memory_order_acquire) == nullptr)
+        {
+            grow(index >> chunkBits);
+        }
+
+        return index;
+    }
+
+    // n indices at once: recycled ones first, the rest as one contiguous fresh range
+    // false - not that many left, nothing is handed out
+    bool allocate(unsigned n, unsigned* out)
+    {
+        unsigned taken = 0;
+
+        uint64_t current = head.load(boost::memory_order_acquire);
+
+        while (taken < n && (current & 0xffffffff) != 0)
+        {
+            unsigned index = (unsigned)(current & 0xffffffff) - 1;
+            uint64_t next = ((current >> 32) + 1) << 32 | slot(index).next.load(boost::memory_order_relaxed);
+
+            if (head.compare_exchange_weak(current, next, boost::memory_order_acquire))
+            {
+                out[taken++] = index;
+            }
+        }
+
+        if (taken == n)
+        {
+            return true;
+        }
+
+        unsigned first;
+
+        if (!claim(n - taken, first))
+        {
+            while (taken > 0)
+            {
+                free(out[--taken]);
+            }
+
+            return false;
+        }
+
+        for (unsigned index = first; taken < n; ++index)
+        {
+            if ((index == first || (index & (chunkSize - 1)) == 0) && chunks[index >> chunkBits].load(boost::memory_order_acquire) == nullptr)
+            {
+                grow(index >> chunkBits);
+            }
+
+            out[taken++] = index;
+        }
+
+        return true;
+    }
+
+    // makes sure the chunks for the first n indices exist, without handing any out;
+    // memory is first touched by the calling thread, which is how it ends up on that thread's NUMA node
+    void reserve(unsigned n)
+    {
+        for (unsigned chunk = 0; chunk < maxChunks && (chunk << chunkBits) < n; ++chunk)
+        {
+            if (chunks[chunk].load(boost::memory_order_acquire) == nullptr)
+            {
+                grow(chunk);
+            }
+        }
+    }
+
+    void free(unsigned index)
+    {
+        uint64_t current = head.load(boost::memory_order_relaxed);
+        uint64_t next;
+
+        do
+        {
+            slot(index).next.store((unsigned)(current & 0xffffffff), boost::memory_order_relaxed);
+
+            next = ((current >> 32) + 1) << 32 | (index + 1);
+        } while (!head.compare_exchange_weak(current, next, boost::memory_order_release));
+    }
+
+    Type& operator[](unsigned index)
+    {
+        return slot(index).value;
+    }
+
+    // index was handed out at some point, so its object exists (it may be free again)
+    bool contains(unsigned index)
+    {
+        return index < used.load(boost::memory_order_acquire) && chunks[index >> chunkBits].load(boost::memory_order_acquire) != nullptr;
+    }
+
+    // chunks allocated so far, stays flat once the slab covers the peak number of live objects
+    unsigned allocations() const
+    {
+        return chunkAllocations.load();
+    }
+
+private:
+
+    struct Slot
+    {
+        Type value;
+        boost::atomic<unsigned> next;
+    };
+
+    // n fresh indices from first on; used never goes past capacity, not even for a moment
+    bool claim(unsigned n, unsigned& first)
+    {
+        first = used.load();
+
+        do
+        {
+            if (n > capacity - first)
+            {
+                return false;
+            }
+        } while (!used.compare_exchange_weak(first, first + n));
+
+        return true;
+    }
+
+    Slot& slot(unsigned index)
+    {
+        return chunks[index >> chunkBits].load(boost::memory_order_acquire)[index & (chunkSize - 1)];
+    }
+
+    void grow(unsigned chunk)
+    {
+        boost::mutex::scoped_lock lock(growSync);
+
+        if (chunks[chunk].load(boost::memory_order_relaxed) == nullptr)
+        {
+            chunks[chunk].store(new Slot[chunkSize], boost::memory_order_release);
+
+            ++chunkAllocations;
+        }
+    }
+
+    boost::atomic<uint64_t> head; // (tag << 32) | (index + 1), 0 when empty
+    boost::atomic<unsigned> used;
+    boost::atomic<unsigned> chunkAllocations;
+
+    boost::atomic<Slot*> chunks[maxChunks];
+
+    boost::mutex growSync;
+};
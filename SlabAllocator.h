@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include "Slab.h"
+
+// allocator for objects that come and go with every task (a typed task's promise state): single
+// objects are taken from a Slab of blocks of their size, any thread frees them back, and once the
+// slab covers the peak number alive nothing reaches the heap anymore
+// arrays go to operator new as usual
+
+template <size_t Size, size_t Align>
+class BlockPool
+{
+public:
+
+    static void* take()
+    {
+        unsigned index = slab().allocate();
+
+        // past the slab's capacity a block of its own, on the heap
+        auto block = index == Slab<Block>::none ? new Block() : &slab()[index];
+
+        block->index = index;
+
+        return block->storage;
+    }
+
+    static void give(void* storage)
+    {
+        auto block = reinterpret_cast<Block*>(static_cast<unsigned char*>(storage) - offsetof(Block, storage));
+
+        if (block->index == Slab<Block>::none)
+        {
+            delete block;
+        }
+        else
+        {
+            slab().free(block->index);
+        }
+    }
+
+private:
+
+    struct Block
+    {
+        unsigned index;
+
+        alignas(Align) unsigned char storage[Size];
+    };
+
+    // never destroyed: a future may well outlive static destruction
+    static Slab<Block>& slab()
+    {
+        static Slab<Block>* res = new Slab<Block>();
+
+        return *res;
+    }
+};
+
+template <typename T>
+class SlabAllocator
+{
+public:
+
+    typedef T value_type;
+
+    SlabAllocator() noexcept {}
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1)
+        {
+            return static_cast<T*>(BlockPool<sizeof(T), alignof(T)>::take());
+        }
+
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (n == 1)
+        {
+            BlockPool<sizeof(T), alignof(T)>::give(p);
+        }
+        else
+        {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>&) const noexcept { return false; }
+};
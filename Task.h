@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// move-only type-erased void() callable
+// functors up to inlineSize bytes live right inside the task, so a lambda costs no allocation;
+// anything bigger (or with a throwing move) falls back to the heap
+
+class Task
+{
+public:
+
+    static const size_t inlineSize = 56;
+
+    Task() : ops(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f)
+        :
+        ops(&Storage<typename std::decay<F>::type>::table)
+    {
+        Storage<typename std::decay<F>::type>::create(storage, std::forward<F>(f));
+    }
+
+    Task(Task&& other)
+        :
+        ops(other.ops)
+    {
+        if (ops != nullptr)
+        {
+            ops->move(other.storage, storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+
+            ops = other.ops;
+
+            if (ops != nullptr)
+            {
+                ops->move(other.storage, storage);
+                other.ops = nullptr;
+            }
+        }
+
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        ops->invoke(storage);
+    }
+
+    explicit operator bool() const
+    {
+        return ops != nullptr;
+    }
+
+    void reset()
+    {
+        if (ops != nullptr)
+        {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+private:
+
+    struct Ops
+    {
+        void (*invoke)(void* where);
+        void (*move)(void* from, void* to);
+        void (*destroy)(void* where);
+    };
+
+    template <typename F, bool Inline = sizeof(F) <= inlineSize && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<F>::value>
+    struct Storage
+    {
+        template <typename Arg>
+        static void create(void* where, Arg&& f) { new (where) F(std::forward<Arg>(f)); }
+
+        static void invoke(void* where) { (*static_cast<F*>(where))(); }
+
+        static void move(void* from, void* to)
+        {
+            new (to) F(std::move(*static_cast<F*>(from)));
+
+            static_cast<F*>(from)->~F();
+        }
+
+        static void destroy(void* where) { static_cast<F*>(where)->~F(); }
+
+        static const Ops table;
+    };
+
+    template <typename F>
+    struct Storage<F, false>
+    {
+        template <typename Arg>
+        static void create(void* where, Arg&& f) { *static_cast<F**>(where) = new F(std::forward<Arg>(f)); }
+
+        static void invoke(void* where) { (**static_cast<F**>(where))(); }
+
+        static void move(void* from, void* to) { *static_cast<F**>(to) = *static_cast<F**>(from); }
+
+        static void destroy(void* where) { delete *static_cast<F**>(where); }
+
+        static const Ops table;
+    };
+
+    alignas(std::max_align_t) unsigned char storage[inlineSize];
+
+    const Ops* ops;
+};
+
+template <typename F, bool Inline>
+const Task::Ops Task::Storage<F, Inline>::table = { &invoke, &move, &destroy };
+
+template <typename F>
+const Task::Ops Task::Storage<F, false>::table = { &invoke, &move, &destroy };
@@ -0,0 +1,188 @@
+#include <stdexcept>
+
+#include "TaskGraph.h"
+
+TaskGraph::TaskGraph()
+    :
+    pool(nullptr),
+    remaining(0),
+    failed(false)
+{
+}
+
+void TaskGraph::precede(TaskGraph::Node before, TaskGraph::Node after)
+{
+    if (before >= vertices.size() || after >= vertices.size() || before == after)
+    {
+        throw invalid_argument("TaskGraph::precede: bad node");
+    }
+
+    vertices[before]->successors.push_back(after);
+
+    ++vertices[after]->predecessors;
+}
+
+future<void> TaskGraph::run(ThreadPool& pool)
+{
+    if (!acyclic())
+    {
+        throw logic_error("TaskGraph::run: graph has a cycle");
+    }
+
+    this->pool = &pool;
+
+    done = promise<void>();
+    error = nullptr;
+    failed = false;
+
+    auto res = done.get_future();
+
+    if (vertices.empty())
+    {
+        done.set_value();
+
+        return res;
+    }
+
+    remaining = vertices.size();
+
+    vector<Release> roots;
+
+    for (Node i = 0; i < vertices.size(); ++i)
+    {
+        vertices[i]->pending.store(vertices[i]->predecessors, boost::memory_order_relaxed);
+
+        if (vertices[i]->predecessors == 0)
+        {
+            roots.push_back(Release{ this, i });
+        }
+    }
+
+    pool.postAll(roots.begin(), roots.end());
+
+    return res;
+}
+
+void TaskGraph::execute(TaskGraph::Node node)
+{
+    // released nodes the pool had no room for; with the graph failed they only pass the release on
+    vector<Node> stranded;
+
+    while (true)
+    {
+        auto& vertex = *vertices[node];
+
+        if (!failed)
+        {
+            try
+            {
+                vertex.work();
+            }
+            catch (...)
+            {
+                if (!failed.exchange(true))
+                {
+                    error = current_exception();
+                }
+            }
+        }
+
+        bool follow = false;
+        Node next = 0;
+
+        for (auto successor : vertex.successors)
+        {
+            if (vertices[successor]->pending.fetch_sub(1, boost::memory_order_acq_rel) == 1)
+            {
+                if (follow)
+                {
+                    try
+                    {
+                        pool->post(Release{ this, next });
+                    }
+                    catch (...)
+                    {
+                        if (!failed.exchange(true))
+                        {
+                            error = current_exception();
+                        }
+
+                        stranded.push_back(next);
+                    }
+                }
+
+                follow = true;
+                next = successor;
+            }
+        }
+
+        if (remaining.fetch_sub(1, boost::memory_order_acq_rel) == 1)
+        {
+            // the waiter may destroy the graph as soon as the future is ready, so nothing of it is touched after
+            auto finished = std::move(done);
+
+            if (failed)
+            {
+                finished.set_exception(error);
+            }
+            else
+            {
+                finished.set_value();
+            }
+
+            return;
+        }
+
+        if (!follow)
+        {
+            if (stranded.empty())
+            {
+                return;
+            }
+
+            next = stranded.back();
+
+            stranded.pop_back();
+        }
+
+        node = next;
+    }
+}
+
+bool TaskGraph::acyclic() const
+{
+    // Kahn's algorithm: every node gets sorted unless some of them wait on each other
+    vector<unsigned> waiting(vertices.size());
+    vector<Node> ready;
+
+    for (Node i = 0; i < vertices.size(); ++i)
+    {
+        waiting[i] = vertices[i]->predecessors;
+
+        if (waiting[i] == 0)
+        {
+            ready.push_back(i);
+        }
+    }
+
+    size_t sorted = 0;
+
+    while (!ready.empty())
+    {
+        Node node = ready.back();
+
+        ready.pop_back();
+
+        ++sorted;
+
+        for (auto successor : vertices[node]->successors)
+        {
+            if (--waiting[successor] == 0)
+            {
+                ready.push_back(successor);
+            }
+        }
+    }
+
+    return sorted == vertices.size();
+}
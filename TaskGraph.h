@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <future>
+#include <boost\atomic.hpp>
+#include <boost\noncopyable.hpp>
+
+#include "ThreadPool.h"
+
+// tasks with dependencies, handed to a ThreadPool as a whole
+// every node counts its unfinished predecessors; whoever brings the count to zero releases the node
+// right from its own worker (the last one released is run in place), so stages follow each other
+// without a round trip through the caller
+
+class TaskGraph : boost::noncopyable
+{
+public:
+
+    typedef size_t Node;
+
+    TaskGraph();
+
+    template <typename F>
+    Node add(F&& work);
+
+    // after starts only once before has finished
+    void precede(Node before, Node after);
+
+    // the graph must stay alive and unchanged until the future is ready;
+    // the first exception thrown by a node ends up in the future and nodes not started yet are skipped
+    future<void> run(ThreadPool& pool);
+
+private:
+
+    struct Vertex
+    {
+        Vertex(Task&& work) : work(std::move(work)), predecessors(0), pending(0) {}
+
+        Task work;
+
+        vector<Node> successors;
+        unsigned predecessors;
+
+        boost::atomic<unsigned> pending;
+    };
+
+    struct Release
+    {
+        TaskGraph* graph;
+        Node node;
+
+        void operator() () { graph->execute(node); }
+    };
+
+    vector<unique_ptr<Vertex>> vertices;
+
+    ThreadPool* pool;
+
+    boost::atomic<size_t> remaining;
+    boost::atomic<bool> failed;
+    exception_ptr error;
+
+    promise<void> done;
+
+    void execute(Node node);
+    bool acyclic() const;
+};
+
+template <typename F>
+TaskGraph::Node TaskGraph::add(F&& work)
+{
+    vertices.push_back(unique_ptr<Vertex>(new Vertex(Task(std::forward<F>(work)))));
+
+    return vertices.size() - 1;
+}
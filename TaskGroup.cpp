@@ -0,0 +1,183 @@
+#include "TaskGroup.h"
+
+TaskGroup::TaskGroup(ThreadPool& pool)
+    :
+    pool(pool),
+    state(make_shared<State>())
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    cancel();
+
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+        // nobody left to hand it to
+    }
+}
+
+void TaskGroup::push(Task&& work)
+{
+    {
+        boost::mutex::scoped_lock lock(state->sync);
+
+        if (state->cancelled)
+        {
+            return;
+        }
+
+        state->queued.push_back(std::move(work));
+
+        ++state->unfinished;
+    }
+
+    if (state->changed.waiters() > 0)
+    {
+        state->changed.notifyAll(); // a waiter with nothing to help with may take this one
+    }
+
+    auto claim = state;
+
+    try
+    {
+        pool.post([claim] { claim->execute(); });
+    }
+    catch (const length_error&)
+    {
+        // every task record is taken: the work stays in the list without a claim, wait() runs it
+    }
+}
+
+bool TaskGroup::wait()
+{
+    while (true)
+    {
+        if (state->execute())
+        {
+            continue;
+        }
+
+        auto key = state->changed.prepareWait();
+
+        bool empty;
+
+        {
+            boost::mutex::scoped_lock lock(state->sync);
+
+            empty = state->queued.empty();
+        }
+
+        if (state->unfinished == 0 || !empty)
+        {
+            state->changed.cancelWait();
+
+            if (state->unfinished == 0)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        // everything left is running elsewhere
+        state->changed.wait(key, -1);
+    }
+
+    bool completed = state->cancelled == 0;
+
+    auto error = state->error;
+
+    state->cancelled = 0;
+    state->failed = false;
+    state->error = nullptr;
+
+    if (error)
+    {
+        rethrow_exception(error);
+    }
+
+    return completed;
+}
+
+void TaskGroup::cancel()
+{
+    state->drop();
+}
+
+bool TaskGroup::State::execute()
+{
+    Task work;
+
+    {
+        boost::mutex::scoped_lock lock(sync);
+
+        if (queued.empty())
+        {
+            return false;
+        }
+
+        work = std::move(queued.front());
+
+        queued.pop_front();
+    }
+
+    try
+    {
+        work();
+    }
+    catch (boost::thread_interrupted&)
+    {
+        work = Task();
+
+        finish(1);
+
+        throw; // the pool is going away
+    }
+    catch (...)
+    {
+        if (!failed.exchange(true))
+        {
+            error = current_exception();
+        }
+
+        drop(); // the rest of the group goes with it
+    }
+
+    work = Task();
+
+    finish(1);
+
+    return true;
+}
+
+void TaskGroup::State::drop()
+{
+    deque<Task> dropped;
+
+    {
+        boost::mutex::scoped_lock lock(sync);
+
+        cancelled = 1;
+
+        dropped.swap(queued);
+    }
+
+    size_t n = dropped.size();
+
+    dropped.clear(); // before the count drops, a waiter may free what they refer to once it is zero
+
+    finish(n);
+}
+
+void TaskGroup::State::finish(size_t n)
+{
+    if (n > 0 && unfinished.fetch_sub(n) == n)
+    {
+        changed.notifyAll();
+    }
+}
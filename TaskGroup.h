@@ -0,0 +1,101 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <type_traits>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+#include "ThreadPool.h"
+
+// fan-out / fan-in over a ThreadPool without ids or futures per task
+// the group's work waits in a list of its own; what goes into the pool is a claim per task that
+// takes whatever is first in that list. wait() takes from the same list on the calling thread, so a
+// waiter (a pool worker included) runs group work instead of blocking while any is left, and
+// cancel() empties the list in one go: the claims still queued in the pool find nothing and return
+
+class TaskGroup : boost::noncopyable
+{
+public:
+
+    TaskGroup(ThreadPool& pool);
+
+    // cancels and waits for whatever is still running
+    ~TaskGroup();
+
+    // f() or f(const CancellationToken&); may be called from group tasks too
+    // after cancel() nothing is added until wait() has returned
+    template <typename F>
+    void run(F&& f);
+
+    // until every task run so far has finished or been dropped, helping with the ones not started yet
+    // false - cancelled; the first exception a task threw is rethrown here (it cancels the rest)
+    // the group can be used again afterwards
+    bool wait();
+
+    // queued tasks are dropped right away, running ones see their CancellationToken cancelled
+    void cancel();
+
+    bool isCancelled() const { return state->cancelled != 0; }
+
+private:
+
+    // outlives the group for as long as claims for it sit in the pool
+    struct State
+    {
+        State() : unfinished(0), cancelled(0), failed(false) {}
+
+        // claim or wait: the first task of the list, false - none left
+        bool execute();
+
+        // cancels and empties the list
+        void drop();
+
+        void finish(size_t n);
+
+        deque<Task> queued;
+        boost::mutex sync;
+
+        boost::atomic<size_t> unfinished; // queued plus running
+
+        // a token's stamp: 0 - live, 1 - cancelled
+        boost::atomic<unsigned long long> cancelled;
+
+        boost::atomic<bool> failed;
+        exception_ptr error;
+
+        // a task finished or was added; waiters look at the list again
+        EventCount changed;
+    };
+
+    template <typename F>
+    static void invoke(F& f, const CancellationToken& token);
+
+    void push(Task&& work);
+
+    ThreadPool& pool;
+
+    shared_ptr<State> state;
+};
+
+template <typename F>
+void TaskGroup::run(F&& f)
+{
+    CancellationToken token(&state->cancelled, 0, &pool.stopping);
+
+    push(Task([token, f = decay_t<F>(std::forward<F>(f))]() mutable { invoke(f, token); }));
+}
+
+template <typename F>
+void TaskGroup::invoke(F& f, const CancellationToken& token)
+{
+    if constexpr (is_invocable<F&, const CancellationToken&>::value)
+    {
+        f(token);
+    }
+    else
+    {
+        f();
+    }
+}
@@ -1,319 +1,1306 @@
-#include <boost\lexical_cast.hpp>
+#include <algorithm>
+#include <stdexcept>
 
 #include "ThreadPool.h"
 
-ThreadPool::BaseThread::BaseThread()
+thread_local ThreadPool::BaseThread* ThreadPool::currentThread = nullptr;
+
+static void bump(boost::atomic<unsigned long long>& counter, unsigned long long n = 1)
+{
+    counter.store(counter.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+}
+
+ThreadPool::BaseThread::BaseThread(ThreadPool* pool)
     :
-    task(nullptr),
-    last_result(0),
+    pool(pool),
     last_task_id(0),
-    watcher_thread(nullptr),
-    execution_thread(nullptr)
+    seed(0),
+    worker_thread(nullptr),
+    task(nullptr),
+    stagedSince(0),
+    started(0),
+    node(0)
 {
 }
 
 ThreadPool::BaseThread::BaseThread(const ThreadPool::BaseThread& obj)
     :
-    task(obj.task),
+    pool(obj.pool),
     last_task_id(obj.last_task_id),
-    watcher_thread(nullptr),
-    execution_thread(nullptr)
+    seed(0),
+    worker_thread(nullptr),
+    task(obj.task),
+    stagedSince(0),
+    started(0),
+    node(0)
 {
 }
 
-void ThreadPool::BaseThread::performInParallel()
+bool ThreadPool::BaseThread::beginTask()
 {
-    last_result = (*task)();
-    task = nullptr;
+    typedef TaskRecord tr;
+
+    unsigned generation = (unsigned)(last_task_id >> 32);
+
+    auto expected = tr::stamp(generation, tr::QUEUED);
+
+    if (!task->stamp_value.compare_exchange_strong(expected, tr::stamp(generation, tr::RUNNING)))
+    {
+        // killed while still queued: dropped without ever running
+        bump(counters.killed);
+
+        pool->releaseRecord(task);
+
+        task = nullptr;
+
+        ++pool->available;
+
+        return false;
+    }
+
+    started = pool->clockNs();
+
+    counters.wait.add(max(started - task->submitted, 0LL));
+
+    if (!staged.empty() && (pool->reporterIdle.load(boost::memory_order_relaxed) || started - stagedSince >= stageDelay))
+    {
+        pool->flushResults(staged);
+    }
+
+    return true;
 }
 
-void ThreadPool::BaseThread::performAndReturn(boost::unique_lock<boost::try_mutex>& lock)
+void ThreadPool::BaseThread::performAndReturn()
 {
-    try
-    {
-        execution_thread = new boost::thread(boost::bind(&BaseThread::performInParallel, this));
+    typedef TaskRecord tr;
 
-        execution_thread->join();
+    unsigned generation = (unsigned)(last_task_id >> 32);
 
-        execution_thread = nullptr;
+    // killTask only flips the stamp; an exception here means the destructor interrupted the worker
+    bool killed = false;
 
-        task_performed.notify_one();
+    auto expected = tr::stamp(generation, tr::RUNNING);
 
-        result_accuired.wait(lock);
+    try
+    {
+        task->work();
     }
     catch (boost::thread_interrupted&)
     {
-        execution_thread = nullptr;
-        task = nullptr;
+        killed = true;
+    }
+
+    if (!task->stamp_value.compare_exchange_strong(expected, tr::stamp(generation, tr::FINISHED)))
+    {
+        // killTask got there first, the task saw its token (or ran to the end regardless);
+        // either way the result goes and the worker carries on with the next task
+        killed = true;
+    }
+
+    long long finished = pool->clockNs();
+
+    counters.run.add(finished - started);
+
+    bump(counters.busy, finished - started);
+    bump(killed ? counters.killed : counters.completed);
+
+    unsigned hot = localQueue() != nullptr ? Tracer::HOT : 0;
+
+    pool->trace(Tracer::FINISH, last_task_id, hot | (killed ? Tracer::KILLED : task->report ? Tracer::REPORTED : 0));
+
+    if (!killed && task->report)
+    {
+        if (staged.empty())
+        {
+            stagedSince = finished;
+        }
+
+        staged.push_back({ last_task_id, task->result });
+
+        if (staged.size() >= stageSize)
+        {
+            pool->flushResults(staged);
+        }
     }
+
+    pool->releaseRecord(task);
+
+    task = nullptr;
+
+    ++pool->available;
 }
 
 void ThreadPool::BaseThread::interrupt()
 {
-    auto to_interrupt = execution_thread != nullptr ? execution_thread : watcher_thread;
-    
-    to_interrupt->interrupt();
+    worker_thread->interrupt();
 }
 
+ThreadPool::HotThread::HotThread(ThreadPool* pool)
+    :
+    BaseThread(pool)
+{}
+
+ThreadPool::HotThread::HotThread(const HotThread& other)
+    :
+    BaseThread(other.pool)
+{}
+
 void ThreadPool::HotThread::performTasks()
 {
-    try
+    currentThread = this;
+
+    if (!cpus.empty())
     {
-        boost::unique_lock<boost::try_mutex> lock(mutex);
+        Topology::pin(cpus);
+    }
 
-        while (true)
+    seed = (unsigned)(this - &pool->hotThreads[0]) + 1;
+
+    try
+    {
+        while (!pool->stopping)
         {
-            task_recieved.wait(lock);
+            if (!pool->takeTask(*this))
+            {
+                pool->flushResults(staged);
 
-            performAndReturn(lock);
+                if (!pool->spinForTask())
+                {
+                    pool->waitForTask(-1);
+                }
+
+                continue;
+            }
+
+            if (!beginTask())
+            {
+                continue;
+            }
+
+            pool->trace(Tracer::START, last_task_id, Tracer::HOT);
+
+            performAndReturn();
         }
     }
     catch (boost::thread_interrupted&)
     {
     }
+
+    pool->flushResults(staged);
 }
 
 void ThreadPool::HotThread::run()
 {
-    watcher_thread = new boost::thread(boost::bind(&HotThread::performTasks, this));
+    worker_thread = new boost::thread(boost::bind(&HotThread::performTasks, this));
 }
 
 void ThreadPool::FreeThread::performTasks()
 {
+    static boost::atomic<unsigned> next_seed(0);
+
+    currentThread = this;
+
+    // no index to seed from, and warm spares start without a task id: a zero xorshift state would stay
+    // zero and always pick hot thread 0 first. odd, so never zero
+    seed = next_seed.fetch_add(1, boost::memory_order_relaxed) * 2654435761u | 1;
+
     try
     {
-        boost::unique_lock<boost::try_mutex> lock(mutex);
+        if (task != nullptr && beginTask()) // task it was spawned for
+        {
+            pool->trace(Tracer::START, last_task_id, Tracer::HANDOFF);
 
-        do
+            performAndReturn();
+        }
+
+        while (!pool->stopping)
         {
-            if (task != nullptr) // when previous task has been killed and this function restarted
+            if (!pool->takeTask(*this))
+            {
+                pool->flushResults(staged);
+
+                if (!pool->waitForTask(timeout) && pool->tryRetire())
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            if (!beginTask())
             {
-                performAndReturn(lock);
+                continue;
             }
-        } while (task_recieved.wait_for(lock, boost::chrono::seconds(timeout)) != boost::cv_status::timeout);
-        
-        // whats wrong with it? why do i get http://stackoverflow.com/questions/23635831/boost-assertion-on-thread-interruption?
 
-        thread_death.notify_all();
+            pool->trace(Tracer::START, last_task_id);
+
+            performAndReturn();
+        }
     }
     catch (boost::thread_interrupted&)
     {
     }
+
+    pool->flushResults(staged);
+
+    boost::mutex::scoped_lock lock(pool->listSync);
+
+    if (pool->stopping)
+    {
+        return; // destructor joins and frees everything itself
+    }
+
+    pool->trace(Tracer::REAP, last_task_id);
+
+    pool->retire(*this);
+
+    // reaped: nobody is going to join us, and erasing the list entry destroys this object,
+    // so nothing below may touch a member
+    auto clock = pool->policy.clock;
+
+    worker_thread->detach();
+
+    delete worker_thread;
+
+    pool->freeThreads.erase(self);
+
+    clock->leave();
 }
 
-ThreadPool::FreeThread::FreeThread(unsigned timeout)
+ThreadPool::FreeThread::FreeThread(ThreadPool* pool, unsigned timeout)
     :
-    BaseThread(),
+    BaseThread(pool),
     timeout(timeout)
 {}
 
 ThreadPool::FreeThread::FreeThread(const FreeThread& other)
     :
-    BaseThread(),
+    BaseThread(other.pool),
     timeout(other.timeout)
 {}
 
 void ThreadPool::FreeThread::run()
 {
-    watcher_thread = new boost::thread(boost::bind(&FreeThread::performTasks, this));
+    worker_thread = new boost::thread(boost::bind(&FreeThread::performTasks, this));
 }
 
 ThreadPool::ThreadPool(int _count, int _timeout)
     :
-    hotThreads(_count),
+    ThreadPool(_count, Policy(_timeout))
+{
+}
+
+ThreadPool::ThreadPool(int _count, const Policy& _policy)
+    :
     count(_count),
-    timeout(_timeout),
-    taskCounter(0)
+    policy(_policy),
+    traceSource(Tracer::newSource()),
+    stopping(false),
+    available(_count),
+    queued(0),
+    freeCount(0),
+    spawnSchedule(0),
+    lastReap(0),
+    highQueue(queueCapacity),
+    lowQueue(queueCapacity),
+    deadlined(0),
+    hotThreads(_count, HotThread(this)),
+    retiredCompleted(0),
+    retiredKilled(0),
+    reporterStopping(false),
+    reporterIdle(true),
+    sink(cout),
+    wheel(nullptr)
 {
+    // without hot threads a zero cap would leave nobody to run anything
+    policy.maxFreeThreads = max(policy.maxFreeThreads, count == 0 ? 1 : 0);
+    policy.warmSpares = min(policy.warmSpares, policy.maxFreeThreads);
+
+    place();
+
+    reporter = new boost::thread(boost::bind(&ThreadPool::reportResults, this));
+
     for (auto& thread : hotThreads)
     {
+        policy.clock->enter();
+
         thread.run();
     }
+
+    for (int i = 0; i < policy.warmSpares; ++i)
+    {
+        ++freeCount;
+        ++available;
+
+        spawnFreeThread(nullptr);
+    }
 }
 
 ThreadPool::~ThreadPool()
 {
+    // timers stop firing first, runs already posted are dropped with the rest of the queue below
+    if (wheel != nullptr)
+    {
+        wheel.load()->stop();
+    }
+
+    {
+        // free threads reaped from here on leave their list entry for us
+        boost::mutex::scoped_lock lock(listSync);
+
+        stopping = true;
+    }
+
+    parking.notifyAll();
+
     for (auto& i : hotThreads)
     {
         i.interrupt();
+        i.worker_thread->join();
+
+        delete i.worker_thread;
     }
 
     for (auto& i : freeThreads)
     {
         i.interrupt();
-    }
+        i.worker_thread->join();
 
-    for (auto& i : watchersForResult)
-    {
-        i.second->interrupt();
+        delete i.worker_thread;
     }
 
-    for (auto& i : watchersForDeaths)
+    // tasks nobody got to; typed ones see a broken promise
+    TaskRecord* left;
+
+    while (highQueue.pop(left) || lowQueue.pop(left))
     {
-        i.second->interrupt();
+        releaseRecord(left);
     }
-}
 
-void ThreadPool::addTask(Callable* task)
-{
-    for (int i = 0; i < count; ++i)
+    for (auto& node : nodes)
     {
-        if (tryAssignTask(task, hotThreads[i]))
+        while (node->queue.pop(left))
         {
-#ifdef TESTING
-            string msg = boost::lexical_cast<string>(hotThreads[i].last_task_id) + " h\n";
-
-            output << msg;
-#endif
-            return;
+            releaseRecord(left);
         }
     }
 
-    for (auto i = freeThreads.begin(); i != freeThreads.end(); ++i)
+    for (auto record : deadlines)
     {
-        if (tryAssignTask(task, *i))
-        {
-#ifdef TESTING
-            string msg = boost::lexical_cast<string>(i->last_task_id) + " f\n";
+        releaseRecord(record);
+    }
 
-            output << msg;
-#endif
-            return;
+    for (auto& i : hotThreads)
+    {
+        while (i.deque.pop(left))
+        {
+            releaseRecord(left);
         }
     }
 
-    boost::mutex::scoped_lock lock(listSync);
+    delete wheel.load();
 
-    freeThreads.push_front(FreeThread(timeout));
+    {
+        boost::mutex::scoped_lock lock(resultsSync);
 
-    auto& new_thread = freeThreads.front();
+        reporterStopping = true;
 
-    assignTask_unsafe(task, new_thread);
+        results_available.notify_one();
+    }
 
-    watchersForDeaths[new_thread.last_task_id] = new boost::thread(boost::bind(&ThreadPool::waitForFreeThreadDeath, this, _1), boost::ref(new_thread));
+    reporter->join();
 
-    new_thread.run();
+    delete reporter;
 
 #ifdef TESTING
-    string msg = boost::lexical_cast<string>(new_thread.last_task_id) + " n\n";
+    if (!outputName.empty())
+    {
+        ofstream output(outputName);
 
-    output << msg;
+        Tracer::exportLines(output, Tracer::collect(traceSource));
+    }
 #endif
 }
 
-void ThreadPool::killTask(unsigned id)
+void ThreadPool::trace(Tracer::EventT type, ThreadPool::TaskId id, unsigned flags)
+{
+    long long now = clockNs();
+
+    // a virtual clock stands still while things happen, real time keeps their order
+    Tracer::record(traceSource, type, id, flags, now, policy.clock == &Clock::system() ? now : Clock::system().now());
+}
+
+long long ThreadPool::clockNs()
+{
+    return policy.clock->now();
+}
+
+void ThreadPool::countSubmitted(unsigned long long n)
 {
-    auto thread = workingThreads[id];
+    static boost::atomic<unsigned> next_shard(0);
+    static thread_local unsigned shard = next_shard++ % shards;
 
-    thread->interrupt();
-    watchersForResult[id]->interrupt();
+    submitted[shard].value.fetch_add(n, boost::memory_order_relaxed);
+}
 
-    thread->run();
+void ThreadPool::retire(ThreadPool::BaseThread& thread)
+{
+    // caller holds listSync
+    retiredCompleted += thread.counters.completed.load(boost::memory_order_relaxed);
+    retiredKilled += thread.counters.killed.load(boost::memory_order_relaxed);
 
-#ifdef TESTING
+    thread.counters.wait.snapshot(retiredWait);
+    thread.counters.run.snapshot(retiredRun);
+}
 
-    string msg = boost::lexical_cast<string>(id)+" k\n";
+ThreadPool::Stats ThreadPool::stats()
+{
+    Stats res;
 
-    output << msg;
+    res.submitted = 0;
 
-#endif
+    for (unsigned i = 0; i < shards; ++i)
+    {
+        res.submitted += submitted[i].value.load(boost::memory_order_relaxed);
+    }
+
+    res.queued = max(queued.load(), 0);
+    res.hotThreads = count;
 
     boost::mutex::scoped_lock lock(listSync);
 
-    workingThreads.erase(id);
-    watchersForResult.erase(id);
+    res.freeThreads = (int)freeThreads.size();
+    res.completed = retiredCompleted;
+    res.killed = retiredKilled;
+
+    res.wait.merge(retiredWait);
+    res.run.merge(retiredRun);
+
+    auto add = [&res](BaseThread& thread, bool hot)
+    {
+        WorkerStats worker;
+
+        worker.hot = hot;
+        worker.completed = thread.counters.completed.load(boost::memory_order_relaxed);
+        worker.killed = thread.counters.killed.load(boost::memory_order_relaxed);
+        worker.busy = thread.counters.busy.load(boost::memory_order_relaxed);
+
+        res.completed += worker.completed;
+        res.killed += worker.killed;
+
+        thread.counters.wait.snapshot(res.wait);
+        thread.counters.run.snapshot(res.run);
+
+        res.workers.push_back(worker);
+    };
+
+    for (auto& thread : hotThreads)
+    {
+        add(thread, true);
+    }
+
+    for (auto& thread : freeThreads)
+    {
+        add(thread, false);
+    }
+
+    return res;
 }
 
-bool ThreadPool::tryAssignTask(Callable* task, ThreadPool::BaseThread& thread)
+void ThreadPool::exportTrace(ostream& out) const
 {
-    if (thread.mutex.try_lock())
-    {        
-        boost::mutex::scoped_lock lock(listSync);
- 
-        assignTask_unsafe(task, thread);
+    Tracer::exportChrome(out, Tracer::collect(traceSource));
+}
 
-        thread.mutex.unlock();
+ThreadPool::TaskId ThreadPool::addTask(Callable* task)
+{
+    auto record = newRecord();
 
-        return true;
-    }
+    prepare(record, task);
 
-    return false;
+    return enqueue(record);
 }
 
-void ThreadPool::assignTask_unsafe(Callable* task, ThreadPool::BaseThread& thread)
+ThreadPool::TaskId ThreadPool::addTask(Callable* task, ThreadPool::Priority priority)
 {
-    thread.task = task;
-    thread.last_task_id = ++taskCounter;
-    workingThreads[thread.last_task_id] = &thread;
-    watchersForResult[thread.last_task_id] = new boost::thread(boost::bind(&ThreadPool::waitForResult, this, _1), boost::ref(thread));
+    auto record = newRecord();
+
+    record->priority = priority;
+
+    prepare(record, task);
+
+    return enqueue(record);
 }
 
-void ThreadPool::waitForResult(ThreadPool::BaseThread& thread)
+ThreadPool::TaskId ThreadPool::addTask(Callable* task, ThreadPool::Deadline deadline)
 {
-    try
-    {
-        boost::unique_lock<boost::try_mutex> lock(thread.mutex);
+    auto record = newRecord();
 
-        thread.task_recieved.notify_one();
+    record->deadline = boost::chrono::duration_cast<boost::chrono::nanoseconds>(deadline.time_since_epoch()).count();
 
-        thread.task_performed.wait(lock);
+    prepare(record, task);
 
-        string msg = boost::lexical_cast<string>(thread.last_task_id) + " ";
+    return enqueue(record);
+}
 
-#ifdef TESTING
+void ThreadPool::prepare(ThreadPool::TaskRecord* record, Callable* task)
+{
+    record->report = true;
+    record->work = [this, record, task = unique_ptr<Callable>(task)] { record->result = (*task)(token(record)); };
+}
 
-        msg += "r\n";
+CancellationToken ThreadPool::token(ThreadPool::TaskRecord* record)
+{
+    typedef TaskRecord tr;
 
-        output << msg;
+    // killTask moves the stamp from RUNNING to KILLED, the slot's next task comes with another generation
+    return CancellationToken(&record->stamp_value, tr::stamp((unsigned)(record->task_id >> 32), tr::RUNNING), &stopping);
+}
 
-#else
-        msg += boost::lexical_cast<string>(thread.last_result) + "\n";
+ThreadPool::TaskRecord* ThreadPool::newRecord()
+{
+    unsigned node = submitNode();
 
-        cout << msg;
+    unsigned slot = nodes[node]->records.allocate();
 
-#endif
+    if (slot == Slab<TaskRecord>::none)
+    {
+        throw length_error("ThreadPool: out of task records");
+    }
+
+    return initRecord(node, slot);
+}
 
-        boost::mutex::scoped_lock listLock(listSync);
+vector<ThreadPool::TaskRecord*> ThreadPool::newRecords(size_t n)
+{
+    vector<unsigned> slots(n);
 
-        workingThreads.erase(thread.last_task_id);
-        watchersForResult.erase(thread.last_task_id);
+    unsigned node = submitNode();
 
-        thread.result_accuired.notify_one();
+    if (n > Slab<TaskRecord>::capacity || (n > 0 && !nodes[node]->records.allocate((unsigned)n, slots.data())))
+    {
+        throw length_error("ThreadPool: out of task records");
     }
-    catch (boost::thread_interrupted&)
+
+    vector<TaskRecord*> batch;
+
+    batch.reserve(n);
+
+    for (auto slot : slots)
     {
+        batch.push_back(initRecord(node, slot));
     }
+
+    return batch;
 }
 
-void ThreadPool::waitForFreeThreadDeath(ThreadPool::FreeThread& thread)
+ThreadPool::TaskRecord* ThreadPool::initRecord(unsigned node, unsigned slot)
 {
-    try
-    {
-        boost::unique_lock<boost::try_mutex> lock(thread.mutex);
+    auto record = &nodes[node]->records[slot];
 
-        thread.thread_death.wait(lock);
+    unsigned generation = (unsigned)(record->stamp_value.load() >> 32);
 
-        boost::mutex::scoped_lock listLock(listSync);
+    record->stamp_value.store(TaskRecord::stamp(generation, TaskRecord::QUEUED));
 
-#ifdef TESTING
-        string msg = boost::lexical_cast<string>(thread.last_task_id) + " t\n";
+    record->task_id = (TaskId)generation << 32 | ((node << 24 | slot) + 1);
+    record->node = node;
+    record->slot = slot;
+    record->priority = NORMAL;
+    record->deadline = 0;
+    record->report = false;
 
-        output << msg;
-#endif
+    return record;
+}
+
+void ThreadPool::releaseRecord(ThreadPool::TaskRecord* record)
+{
+    // drops the payload (and a typed task's promise) now, the record itself goes back to the slab
+    record->work.reset();
+
+    // stale ids stop matching from here on
+    unsigned generation = (unsigned)(record->stamp_value.load() >> 32);
+
+    record->stamp_value.store(TaskRecord::stamp(generation + 1, TaskRecord::FREE));
+
+    nodes[record->node]->records.free(record->slot);
+}
+
+ThreadPool::TaskId ThreadPool::enqueue(ThreadPool::TaskRecord* record)
+{
+    // record may be run and recycled as soon as it is published
+    TaskId id = record->task_id;
+
+    trace(Tracer::SUBMIT, id);
 
-        for (auto i = freeThreads.begin(); i != freeThreads.end(); ++i)
+    record->submitted = clockNs();
+
+    countSubmitted(1);
+
+    auto self = currentThread;
+
+    if (available.fetch_sub(1) > 0)
+    {
+        if (self != nullptr && self->pool == this && self->localQueue() != nullptr && record->priority == NORMAL && record->deadline == 0)
         {
-            if (thread.last_task_id == i->last_task_id)
-            {
-                freeThreads.erase(i);
+            // submitted from inside a hot thread: keep it local, the idle worker comes and steals it
+            self->localQueue()->push(record);
 
-                break;
-            }
+            ++queued;
+
+            wakeWorker();
+
+            return id;
         }
 
-        watchersForDeaths.erase(thread.last_task_id);
+        if (pushShared(record))
+        {
+            ++queued;
+
+            wakeWorker();
+
+            return id;
+        }
     }
-    catch (boost::thread_interrupted&)
+
+    // every worker is busy (or the queue is full), the task gets a thread of its own if the policy allows;
+    // nothing stays in a local deque without an idle worker to steal it, its submitter may be about to block on it
+    if (reserveFreeThread())
+    {
+        ++available;
+
+        spawnFreeThread(record);
+
+        return id;
+    }
+
+    // otherwise it waits for the next worker that becomes idle
+    while (!pushShared(record))
+    {
+        boost::this_thread::yield();
+    }
+
+    ++queued;
+
+    wakeWorker();
+
+    return id;
+}
+
+void ThreadPool::enqueue(ThreadPool::TaskRecord** batch, size_t n, bool reserved)
+{
+    if (n == 0)
+    {
+        return;
+    }
+
+    long long now = clockNs();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        trace(Tracer::SUBMIT, batch[i]->task_id);
+
+        batch[i]->submitted = now;
+    }
+
+    countSubmitted(n);
+
+    // one unit per task; the ones that found an idle worker are the ones worth a wakeup
+    // (reserved - the caller already holds a unit for each)
+    int idle = reserved ? (int)n : min(max(available.fetch_sub((int)n), 0), (int)n);
+
+    auto self = currentThread;
+
+    size_t done = 0;
+
+    auto& queue = nodes[batch[0]->node]->queue;
+
+    if (self != nullptr && self->pool == this && self->localQueue() != nullptr)
     {
+        // as many as idle workers can steal stay local, the rest take the same way as anybody else's
+        for (; done < (size_t)idle; ++done)
+        {
+            self->localQueue()->push(batch[done]);
+        }
+    }
+    else if (idle > 0 && queue.push(batch, idle))
+    {
+        done = idle;
+    }
+
+    size_t pushed = done;
+
+    // the rest would wait behind busy workers, give them threads of their own while the policy allows
+    while (!reserved && done < n && reserveFreeThread())
+    {
+        ++available;
+
+        spawnFreeThread(batch[done++]);
+    }
+
+    while (done < n)
+    {
+        if (queue.push(batch + done, n - done))
+        {
+            pushed += n - done;
+            done = n;
+        }
+        else if (queue.push(batch[done]))
+        {
+            ++pushed;
+            ++done;
+        }
+        else
+        {
+            boost::this_thread::yield();
+        }
+    }
+
+    queued += (int)pushed;
+
+    wakeWorkers(idle);
+}
+
+size_t ThreadPool::reserveIdle(size_t n)
+{
+    int current = available.load();
+    int taken;
+
+    do
+    {
+        taken = (int)min((size_t)max(current, 0), n);
+
+        if (taken == 0)
+        {
+            return 0;
+        }
+    } while (!available.compare_exchange_weak(current, current - taken));
+
+    return taken;
+}
+
+void ThreadPool::cancelTimer(ThreadPool::TimerId id)
+{
+    auto timers = wheel.load();
+
+    if (timers != nullptr)
+    {
+        timers->cancel(id);
+    }
+}
+
+TimingWheel* ThreadPool::timers()
+{
+    auto timers = wheel.load();
+
+    if (timers == nullptr)
+    {
+        boost::mutex::scoped_lock lock(wheelSync);
+
+        timers = wheel.load();
+
+        if (timers == nullptr)
+        {
+            timers = new TimingWheel(this);
+
+            wheel.store(timers);
+        }
+    }
+
+    return timers;
+}
+
+bool ThreadPool::killTask(ThreadPool::TaskId id)
+{
+    typedef TaskRecord tr;
+
+    unsigned handle = (unsigned)(id & 0xffffffff);
+    unsigned generation = (unsigned)(id >> 32);
+
+    if (handle == 0 || (handle - 1) >> 24 >= nodes.size() || !nodes[(handle - 1) >> 24]->records.contains((handle - 1) & 0xffffff))
+    {
+        return false;
+    }
+
+    auto& record = nodes[(handle - 1) >> 24]->records[(handle - 1) & 0xffffff];
+
+    auto expected = tr::stamp(generation, tr::QUEUED);
+
+    if (!record.stamp_value.compare_exchange_strong(expected, tr::stamp(generation, tr::KILLED)))
+    {
+        expected = tr::stamp(generation, tr::RUNNING);
+
+        if (!record.stamp_value.compare_exchange_strong(expected, tr::stamp(generation, tr::KILLED)))
+        {
+            return false; // finished, already killed or not this task anymore
+        }
+
+        // running: its token reads cancelled from now on, the worker itself is left alone
+    }
+
+    trace(Tracer::KILL, id);
+
+    return true;
+}
+
+bool ThreadPool::takeTask(ThreadPool::BaseThread& thread)
+{
+    TaskRecord* next;
+
+    auto local = thread.localQueue();
+
+    // most urgent first: deadlines, high priority, then normal work wherever it sits, low priority last
+    if (!popUrgent(next) && !(local != nullptr && local->pop(next)) && !popNodes(thread, next) && !stealTask(thread, next) && !lowQueue.pop(next))
+    {
+        return false;
+    }
+
+    --queued;
+
+    if (local != nullptr)
+    {
+        trace(Tracer::ASSIGN_HOT, next->task_id, Tracer::HOT);
+    }
+    else
+    {
+        trace(Tracer::ASSIGN_FREE, next->task_id);
+    }
+
+    thread.task = next;
+    thread.last_task_id = next->task_id;
+
+    return true;
+}
+
+bool ThreadPool::stealTask(ThreadPool::BaseThread& thread, ThreadPool::TaskRecord*& stolen)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // xorshift, victims are tried starting from a random hot thread
+    thread.seed ^= thread.seed << 13;
+    thread.seed ^= thread.seed >> 17;
+    thread.seed ^= thread.seed << 5;
+
+    for (int i = 0, start = thread.seed % count; i < count; ++i)
+    {
+        auto& victim = hotThreads[(start + i) % count];
+
+        if (&victim != &thread && victim.deque.steal(stolen))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::popNodes(ThreadPool::BaseThread& thread, ThreadPool::TaskRecord*& next)
+{
+    // own node first, free threads aren't pinned and go by where they happen to run
+    unsigned home = thread.localQueue() != nullptr ? thread.node : submitNode();
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (nodes[(home + i) % nodes.size()]->queue.pop(next))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned ThreadPool::submitNode()
+{
+    if (nodes.size() == 1)
+    {
+        return 0;
+    }
+
+    auto self = currentThread;
+
+    if (self != nullptr && self->pool == this && self->localQueue() != nullptr)
+    {
+        return self->node;
+    }
+
+    return Topology::get().currentNode() % nodes.size();
+}
+
+void ThreadPool::place()
+{
+    const auto& topology = Topology::get();
+
+    if (policy.placement == ANYWHERE)
+    {
+        nodes.push_back(unique_ptr<Node>(new Node));
+
+        return;
+    }
+
+    // every node's queue and first chunk of records are allocated by a thread running on that node
+    for (const auto& cpus : topology.nodes)
+    {
+        boost::thread([this, &cpus] {
+            Topology::pin(cpus);
+
+            unique_ptr<Node> node(new Node);
+
+            node->records.reserve(Slab<TaskRecord>::chunkSize);
+
+            nodes.push_back(std::move(node));
+        }).join();
+    }
+
+    vector<pair<unsigned, unsigned>> cores; // (node, cpu), node by node
+
+    for (unsigned node = 0; node < topology.nodes.size(); ++node)
+    {
+        for (auto cpu : topology.nodes[node])
+        {
+            cores.push_back({ node, cpu });
+        }
+    }
+
+    for (size_t i = 0; i < hotThreads.size(); ++i)
+    {
+        auto& thread = hotThreads[i];
+
+        if (policy.placement == PIN_CORES)
+        {
+            thread.node = cores[i % cores.size()].first;
+            thread.cpus = { cores[i % cores.size()].second };
+        }
+        else
+        {
+            thread.node = (unsigned)(i % nodes.size());
+            thread.cpus = topology.nodes[thread.node];
+        }
+    }
+}
+
+unsigned ThreadPool::allocations() const
+{
+    unsigned res = 0;
+
+    for (auto& node : nodes)
+    {
+        res += node->records.allocations();
+    }
+
+    return res;
+}
+
+bool ThreadPool::popUrgent(ThreadPool::TaskRecord*& next)
+{
+    if (deadlined > 0)
+    {
+        boost::mutex::scoped_lock lock(deadlineSync);
+
+        if (!deadlines.empty())
+        {
+            pop_heap(deadlines.begin(), deadlines.end(), [](TaskRecord* a, TaskRecord* b) { return a->deadline > b->deadline; });
+
+            next = deadlines.back();
+
+            deadlines.pop_back();
+
+            --deadlined;
+
+            return true;
+        }
+    }
+
+    return highQueue.pop(next);
+}
+
+bool ThreadPool::pushShared(ThreadPool::TaskRecord* record)
+{
+    if (record->deadline != 0)
+    {
+        boost::mutex::scoped_lock lock(deadlineSync);
+
+        deadlines.push_back(record);
+
+        push_heap(deadlines.begin(), deadlines.end(), [](TaskRecord* a, TaskRecord* b) { return a->deadline > b->deadline; });
+
+        ++deadlined;
+
+        return true;
+    }
+
+    switch (record->priority)
+    {
+    case HIGH:
+        return highQueue.push(record);
+
+    case LOW:
+        return lowQueue.push(record);
+
+    default:
+        return nodes[record->node]->queue.push(record);
+    }
+}
+
+bool ThreadPool::spinForTask()
+{
+    // busy pool: the next task is usually a few microseconds away, cheaper to watch for it than to sleep
+    for (int i = 0; i < policy.spinCount; ++i)
+    {
+        if (queued > 0 || stopping)
+        {
+            return true;
+        }
+
+        cpu_relax();
+    }
+
+    for (int i = 0; i < policy.yieldCount; ++i)
+    {
+        if (queued > 0 || stopping)
+        {
+            return true;
+        }
+
+        boost::this_thread::yield();
+    }
+
+    return false;
+}
+
+bool ThreadPool::waitForTask(int timeout)
+{
+    long long deadline = timeout < 0 ? Clock::never : clockNs() + timeout * 1000000000LL;
+
+    // a wakeup meant for another worker doesn't restart the timeout
+    while (true)
+    {
+        unsigned key = parking.prepareWait();
+
+        if (queued > 0 || stopping)
+        {
+            parking.cancelWait();
+
+            return true;
+        }
+
+        if (!policy.clock->wait(parking, key, deadline))
+        {
+            return false;
+        }
+    }
+}
+
+bool ThreadPool::tryRetire()
+{
+    // warm spares stay, and with a reap interval only one thread goes per interval;
+    // the rest wait another full timeout before they ask again
+    if (freeCount <= policy.warmSpares)
+    {
+        return false;
+    }
+
+    long long now = clockNs() / 1000000;
+    long long last = lastReap.load();
+
+    if (policy.reapInterval > 0 && now - last < policy.reapInterval)
+    {
+        return false;
+    }
+
+    // idle free thread may only leave if no submitter is counting on it
+    int current = available.load();
+
+    while (current > 0)
+    {
+        if (available.compare_exchange_weak(current, current - 1))
+        {
+            break;
+        }
+    }
+
+    if (current <= 0)
+    {
+        return false;
+    }
+
+    if (policy.reapInterval > 0 && !lastReap.compare_exchange_strong(last, now))
+    {
+        ++available;
+
+        return false;
+    }
+
+    --freeCount;
+
+    return true;
+}
+
+bool ThreadPool::reserveFreeThread()
+{
+    int current = freeCount.load();
+
+    do
+    {
+        if (current >= policy.maxFreeThreads)
+        {
+            return false;
+        }
+    } while (!freeCount.compare_exchange_weak(current, current + 1));
+
+    if (policy.spawnRate <= 0)
+    {
+        return true;
+    }
+
+    // generic cell rate algorithm: one spawn per interval, up to spawnBurst of them early
+    long long interval = 1000000000LL / policy.spawnRate;
+    long long tolerance = interval * (policy.spawnBurst - 1);
+    long long now = clockNs();
+    long long schedule = spawnSchedule.load();
+
+    while (true)
+    {
+        long long start = max(schedule, now);
+
+        if (start - now > tolerance)
+        {
+            --freeCount;
+
+            return false;
+        }
+
+        if (spawnSchedule.compare_exchange_weak(schedule, start + interval))
+        {
+            return true;
+        }
+    }
+}
+
+void ThreadPool::wakeWorker()
+{
+    // spinning workers see the queued count by themselves, only parked ones need the wake
+    parking.notify(1);
+}
+
+void ThreadPool::wakeWorkers(int n)
+{
+    parking.notify(n);
+}
+
+void ThreadPool::spawnFreeThread(ThreadPool::TaskRecord* record)
+{
+    boost::mutex::scoped_lock lock(listSync);
+
+    policy.clock->enter();
+
+    freeThreads.push_front(FreeThread(this, policy.timeout));
+
+    auto& new_thread = freeThreads.front();
+
+    new_thread.self = freeThreads.begin();
+
+    if (record == nullptr) // warm spare
+    {
+        trace(Tracer::SPAWN, 0);
+
+        new_thread.run();
+
+        return;
+    }
+
+    new_thread.task = record;
+    new_thread.last_task_id = record->task_id;
+
+    trace(Tracer::SPAWN, record->task_id, Tracer::HANDOFF);
+    trace(Tracer::ASSIGN_FREE, record->task_id, Tracer::HANDOFF);
+
+    new_thread.run();
+}
+
+void ThreadPool::flushResults(vector<ThreadPool::TaskResult>& staged)
+{
+    if (staged.empty())
+    {
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(resultsSync);
+
+    results.insert(results.end(), staged.begin(), staged.end());
+
+    results_available.notify_one();
+
+    staged.clear();
+}
+
+void ThreadPool::setResultOutput(ostream& out, ResultSink::FormatT format)
+{
+    boost::mutex::scoped_lock lock(sinkSync);
+
+    sink.reset(out, format);
+}
+
+void ThreadPool::setResultHandler(ThreadPool::ResultHandler handler)
+{
+    // once this returns the old handler isn't running anymore
+    boost::mutex::scoped_lock lock(sinkSync);
+
+    this->handler = std::move(handler);
+}
+
+void ThreadPool::reportResults()
+{
+    // single consumer of the completion queue; takes the whole backlog per wakeup
+    vector<TaskResult> batch;
+
+    boost::unique_lock<boost::mutex> lock(resultsSync);
+
+    while (true)
+    {
+        while (results.empty() && !reporterStopping)
+        {
+            reporterIdle = true;
+
+            results_available.wait(lock);
+        }
+
+        reporterIdle = false;
+
+        if (results.empty())
+        {
+            break;
+        }
+
+        batch.swap(results);
+
+        lock.unlock();
+
+        boost::mutex::scoped_lock sinkLock(sinkSync);
+
+        if (handler)
+        {
+            handler(batch.data(), batch.size());
+        }
+        else
+        {
+#ifndef TESTING
+            // test runs read results off the trace instead
+            for (const auto& result : batch)
+            {
+                sink.write(result.task_id, result.value);
+            }
+#endif
+
+            sink.flush();
+        }
+
+        sinkLock.unlock();
+
+        batch.clear();
+
+        lock.lock();
     }
 }
@@ -4,8 +4,31 @@
 
 #include <vector>
 #include <list>
+#include <climits>
 #include <fstream>
+#include <iostream>
+#include <future>
+#include <type_traits>
+#include <iterator>
+#include <memory>
+#include <functional>
+#include <stdexcept>
 #include <boost\thread.hpp>
+#include <boost\atomic.hpp>
+
+#include "BoundedQueue.h"
+#include "WorkStealingDeque.h"
+#include "Task.h"
+#include "Slab.h"
+#include "SlabAllocator.h"
+#include "TimingWheel.h"
+#include "ResultSink.h"
+#include "Tracer.h"
+#include "Histogram.h"
+#include "Topology.h"
+#include "EventCount.h"
+#include "CancellationToken.h"
+#include "Clock.h"
 
 using namespace std;
 
@@ -13,47 +36,327 @@ class Callable
 {
 public:
     Callable() {}
+    virtual ~Callable() {}
     virtual int operator() () { return -1; }
+
+    // override this one instead to be killable mid-run: check the token and return early
+    virtual int operator() (const CancellationToken&) { return (*this)(); }
+};
+
+// what a task returns; typed tasks take the CancellationToken of their run, or nothing
+template <typename F, bool = is_invocable<F&, const CancellationToken&>::value>
+struct TaskResultOf
+{
+    typedef invoke_result_t<F&, const CancellationToken&> type;
+};
+
+template <typename F>
+struct TaskResultOf<F, false>
+{
+    typedef invoke_result_t<F&> type;
 };
 
+template <typename F>
+using task_result_t = typename TaskResultOf<F>::type;
+
 class ThreadPool
 {
 public:
     
+    // (generation << 32) | ((node << 24 | slot) + 1); a slot's generation moves on every time it is reused
+    typedef unsigned long long TaskId;
+
+    // where hot threads run
+    typedef enum {
+        ANYWHERE,     // left to the OS, one shared queue
+        PIN_CORES,    // one core each, filling a node before moving on to the next
+        SPREAD_NODES, // round robin over NUMA nodes, free to move between the cores of their node
+    } Placement;
+
+    // how free threads come and go once every hot thread is busy
+    struct Policy
+    {
+        Policy(int timeout = 1)
+            :
+            timeout(timeout),
+            maxFreeThreads(INT_MAX),
+            spawnRate(0),
+            spawnBurst(1),
+            warmSpares(0),
+            reapInterval(0),
+            placement(ANYWHERE),
+            spinCount(2000),
+            yieldCount(16),
+            clock(&Clock::system())
+        {}
+
+        int timeout;        // seconds a free thread idles before it may be reaped
+        int maxFreeThreads; // past this tasks wait in the queue instead of getting a thread
+        int spawnRate;      // free threads started per second, 0 - unlimited
+        int spawnBurst;     // spawns allowed back to back before spawnRate applies
+        int warmSpares;     // free threads started up front and never reaped
+        int reapInterval;   // milliseconds between two reaps, so a lull doesn't kill everything at once
+
+        // anything but ANYWHERE also gives every NUMA node its own queue and task records
+        Placement placement;
+
+        // an idle hot thread polls with a pause instruction spinCount times, then yields yieldCount times,
+        // and only then parks; a task submitted meanwhile starts without a syscall on either side
+        // 0, 0 - park straight away
+        int spinCount;
+        int yieldCount;
+
+        // time for stats, spawn rate, reaping and idle timeouts; tests swap in a VirtualClock
+        Clock* clock;
+    };
+
+    typedef enum {
+        HIGH,
+        NORMAL,
+        LOW,
+    } Priority;
+
+    // tasks with a deadline run earliest deadline first, ahead of every priority class
+    typedef boost::chrono::steady_clock::time_point Deadline;
+
     ThreadPool(int _count, int _timeout);
+    ThreadPool(int _count, const Policy& _policy);
     ~ThreadPool();
 
-    void addTask(Callable* task);
-    void killTask(unsigned id);
+    // pool takes ownership of the task, result is reported by task id
+    // with every task record in use (Slab::capacity live tasks per node) every way of submitting throws
+    // length_error, and the pool has taken over nothing
+    TaskId addTask(Callable* task);
+
+    TaskId addTask(Callable* task, Priority priority);
+    TaskId addTask(Callable* task, Deadline deadline);
+
+    // a queued task is dropped before it starts; a running one sees its CancellationToken cancelled,
+    // and whatever it returns after that is discarded. unknown, finished or stale ids are ignored
+    // true - killed here, no result is ever going to be reported for it
+    bool killTask(TaskId id);
+
+    // same, but the callable is stored inside the task record instead of on the heap
+    template <typename C, typename = enable_if_t<is_base_of<Callable, decay_t<C>>::value>>
+    TaskId addTask(C&& task);
+
+    // result through a future; once the pool is warm nothing is allocated per call, as long as f fits
+    // inline in a Task
+    template <typename F>
+    auto submit(F&& f) -> future<task_result_t<decay_t<F>>>;
+
+    template <typename F>
+    auto submit(F&& f, Priority priority) -> future<task_result_t<decay_t<F>>>;
+
+    template <typename F>
+    auto submit(F&& f, Deadline deadline) -> future<task_result_t<decay_t<F>>>;
+
+    // a whole range in one round: one slab reservation, one pass over the idle count and
+    // no more wakeups than there are idle workers to take the tasks;
+    // elements are Callable* (pool takes ownership) or Callable values (copied in)
+    template <typename Iterator>
+    vector<TaskId> addTasks(Iterator begin, Iterator end);
+
+    // typed equivalent, futures come back in range order
+    template <typename Iterator>
+    auto submitAll(Iterator begin, Iterator end) -> vector<future<task_result_t<typename iterator_traits<Iterator>::value_type>>>;
+
+    // fire and forget: no id, no result and no future to pay for; the work must not throw
+    template <typename F>
+    void post(F&& f);
+
+    template <typename Iterator>
+    void postAll(Iterator begin, Iterator end);
+
+    // only as much of the range, from the front, as there are workers idle right now; never starts a
+    // thread and never leaves work waiting behind a busy one. returns how many went out
+    template <typename Iterator>
+    size_t postIdle(Iterator begin, Iterator end);
+
+    typedef TimingWheel::TimerId TimerId;
+
+    // f runs on a pool worker once the delay is up, or once every period; nothing sleeps meanwhile,
+    // a pending timer is an entry in the timing wheel. f must not throw
+    template <typename F>
+    TimerId scheduleAfter(boost::chrono::milliseconds delay, F&& f);
+
+    template <typename F>
+    TimerId scheduleEvery(boost::chrono::milliseconds period, F&& f);
+
+    void cancelTimer(TimerId id);
+
+    // where addTask results go, cout as text by default
+    void setResultOutput(ostream& out, ResultSink::FormatT format = ResultSink::TEXT);
+
+    struct TaskResult
+    {
+        TaskId task_id;
+        int value;
+    };
+
+    // or, instead of the sink, this gets every batch the reporter thread takes; empty - back to the sink
+    typedef function<void(const TaskResult* results, size_t n)> ResultHandler;
+
+    void setResultHandler(ResultHandler handler);
+
+    struct WorkerStats
+    {
+        bool hot;
+        unsigned long long completed;
+        unsigned long long killed;
+        unsigned long long busy; // ns spent running tasks
+    };
+
+    struct Stats
+    {
+        unsigned long long submitted;
+        unsigned long long completed; // including threads reaped since
+        unsigned long long killed;
+
+        int queued; // waiting for a worker right now
+        int hotThreads;
+        int freeThreads;
+
+        vector<WorkerStats> workers; // live ones, hot threads first
+
+        Histogram wait; // ns from submission to start
+        Histogram run;  // ns from start to finish
+    };
+
+    // snapshot built from per-thread counters; the workers themselves never share a cache line for it
+    Stats stats();
+
+    // this pool's scheduling events still held by the tracer, as Chrome trace JSON
+    void exportTrace(ostream& out) const;
+
+    // co_await pool.schedule() resumes the coroutine on a pool worker; the handle is all a
+    // suspended coroutine costs, no thread blocks for it (see Coroutine.h)
+    // with every task record in use it goes on where it is instead
+    struct Schedule
+    {
+        ThreadPool* pool;
+
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Handle>
+        bool await_suspend(Handle handle)
+        {
+            try
+            {
+                pool->post([handle]() mutable { handle.resume(); });
+            }
+            catch (const length_error&)
+            {
+                return false;
+            }
+
+            return true;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    Schedule schedule() { return Schedule{ this }; }
+
+    // hot threads, what data-parallel work can count on
+    int workers() const { return count; }
+
+    // chunks of task records allocated so far; flat once the pool has seen its peak load
+    unsigned allocations() const;
 
 private:
 
+    friend class TaskGroup; // its tokens watch stopping too
+
+    class BaseThread;
+
+    struct TaskRecord
+    {
+        typedef enum {
+            FREE,
+            QUEUED,
+            RUNNING,
+            FINISHED,
+            KILLED,
+        } StateT;
+
+        static unsigned long long stamp(unsigned generation, StateT state) { return (unsigned long long)generation << 32 | state; }
+
+        TaskRecord() : stamp_value(0) {}
+
+        TaskId task_id;
+        unsigned node;
+        unsigned slot;
+
+        // generation and state change together, so a CAS with a stale id can never hit the slot's next task
+        boost::atomic<unsigned long long> stamp_value;
+
+        Priority priority;
+        long long deadline; // ns on the steady clock, 0 - none
+
+        long long submitted; // ns, steady clock
+
+        bool report; // addTask results are reported by id, submit delivers through its future
+        int result;
+
+        Task work;
+    };
+
+    // written by the owning thread only (relaxed stores, no locked increments), read by stats()
+    struct alignas(64) Counters
+    {
+        Counters() : completed(0), killed(0), busy(0) {}
+
+        boost::atomic<unsigned long long> completed;
+        boost::atomic<unsigned long long> killed;
+        boost::atomic<unsigned long long> busy;
+
+        HistogramRecorder wait;
+        HistogramRecorder run;
+    };
+
+    struct alignas(64) Shard
+    {
+        Shard() : value(0) {}
+
+        boost::atomic<unsigned long long> value;
+    };
+
     class BaseThread
     {
     public:
-        BaseThread();
+        BaseThread(ThreadPool* pool);
         BaseThread(const BaseThread& thread);
 
         friend class ThreadPool;
     protected:
-        int last_result;
-        unsigned last_task_id;
-
-        boost::try_mutex mutex;
+        ThreadPool* pool;
 
-        boost::condition_variable task_recieved;
-        boost::condition_variable task_performed;
-        boost::condition_variable result_accuired;
+        TaskId last_task_id;
+        unsigned seed;
         
-        boost::thread* watcher_thread;
-        boost::thread* execution_thread;
+        boost::thread* worker_thread;
+
+        TaskRecord* task;
 
-        Callable* task;
+        // results wait here until stageSize of them pile up or the thread runs out of work, and never
+        // past the start of a task while the reporter is idle or the oldest is stageDelay old:
+        // any task may run long, a result must not wait behind it
+        vector<TaskResult> staged;
+        long long stagedSince; // ns, oldest staged result
 
-        void performAndReturn(boost::unique_lock<boost::try_mutex>& lock);
-        void performInParallel();
+        Counters counters;
+        long long started; // ns, current task
+
+        unsigned node;        // queue it looks at first
+        vector<unsigned> cpus; // hot threads are pinned here, empty - not pinned
+
+        bool beginTask();
+        void performAndReturn();
         void interrupt();
 
+        virtual WorkStealingDeque<TaskRecord*>* localQueue() { return nullptr; }
+
         virtual void performTasks() = 0;
         virtual void run() = 0;
     };
@@ -63,8 +366,15 @@ private:
     public:
         friend class ThreadPool;
 
+        HotThread(ThreadPool* pool);
+        HotThread(const HotThread& other);
+
         void performTasks();
         virtual void run();
+    private:
+        WorkStealingDeque<TaskRecord*> deque;
+
+        virtual WorkStealingDeque<TaskRecord*>* localQueue() { return &deque; }
     };
 
     class FreeThread : public BaseThread
@@ -72,43 +382,459 @@ private:
     public:
         friend class ThreadPool;
 
-        FreeThread(unsigned timeout);
+        FreeThread(ThreadPool* pool, unsigned timeout);
         FreeThread(const FreeThread& other);
 
         void performTasks();
     private:
         unsigned timeout;
-        
-        boost::condition_variable thread_death;
+
+        list<FreeThread>::iterator self;
 
         virtual void run();
     };
 
+    static const size_t queueCapacity = 4096;
+    static const size_t stageSize = 64;
+    static const long long stageDelay = 1000000; // ns
+    static const unsigned shards = 16;
+
     int count;
-    int timeout;
-    unsigned taskCounter;
+    Policy policy;
+    unsigned traceSource;
+    boost::atomic<bool> stopping;
+
+    // idle workers minus queued tasks; a submitter that takes a unit is guaranteed a worker
+    boost::atomic<int> available;
+    boost::atomic<int> queued;
+
+    boost::atomic<int> freeCount;
+    boost::atomic<long long> spawnSchedule; // GCRA theoretical arrival time of the next spawn, ns
+    boost::atomic<long long> lastReap;      // ms
+
+    // normal tasks go to the queue of the submitter's node (or a hot thread's deque), records come
+    // from the same node; without placement there is a single node
+    struct Node
+    {
+        Node() : queue(queueCapacity) {}
+
+        BoundedQueue<TaskRecord*> queue;
+        Slab<TaskRecord> records;
+    };
+
+    vector<unique_ptr<Node>> nodes;
+
+    // the other classes have their own queues
+    BoundedQueue<TaskRecord*> highQueue;
+    BoundedQueue<TaskRecord*> lowQueue;
+
+    vector<TaskRecord*> deadlines; // min-heap on deadline
+    boost::atomic<int> deadlined;
+    boost::mutex deadlineSync;
+
+
+    // idle workers that gave up spinning
+    EventCount parking;
 
     vector<HotThread> hotThreads;
     list<FreeThread> freeThreads;
-    map< unsigned, BaseThread* > workingThreads;
-    map< unsigned, boost::thread* > watchersForResult;
-    map< unsigned, boost::thread* > watchersForDeaths;
 
     boost::mutex listSync;
 
-    bool tryAssignTask(Callable* task, BaseThread& thread);
-    void assignTask_unsafe(Callable* task, BaseThread& thread);
-    void waitForResult(BaseThread& thread);
-    void waitForFreeThreadDeath(FreeThread& thread);
+    // submissions, spread over padded shards picked per submitting thread
+    Shard submitted[shards];
+
+    // what reaped free threads had counted; under listSync
+    unsigned long long retiredCompleted;
+    unsigned long long retiredKilled;
+    Histogram retiredWait;
+    Histogram retiredRun;
+
+    vector<TaskResult> results;
+    bool reporterStopping;
+    boost::atomic<bool> reporterIdle; // waiting for results, a flush costs it nothing in batching
+
+    boost::mutex resultsSync;
+    boost::condition_variable results_available;
+
+    boost::thread* reporter;
+
+    ResultSink sink;
+    ResultHandler handler;
+    boost::mutex sinkSync;
+
+    static thread_local BaseThread* currentThread;
+
+    // started with the first timer
+    boost::atomic<TimingWheel*> wheel;
+    boost::mutex wheelSync;
+
+    bool takeTask(BaseThread& thread);
+    bool stealTask(BaseThread& thread, TaskRecord*& stolen);
+    bool popUrgent(TaskRecord*& next);
+    bool pushShared(TaskRecord* record);
+    bool spinForTask();
+    bool waitForTask(int timeout);
+    bool tryRetire();
+    bool reserveFreeThread();
+    void wakeWorker();
+    void wakeWorkers(int n);
+    TaskRecord* newRecord();
+    vector<TaskRecord*> newRecords(size_t n);
+    TaskRecord* initRecord(unsigned node, unsigned slot);
+    CancellationToken token(TaskRecord* record);
+    unsigned submitNode();
+    bool popNodes(BaseThread& thread, TaskRecord*& next);
+    void place();
+    void releaseRecord(TaskRecord* record);
+    TaskId enqueue(TaskRecord* record);
+    void enqueue(TaskRecord** batch, size_t n, bool reserved = false);
+    size_t reserveIdle(size_t n);
+    void spawnFreeThread(TaskRecord* record);
+    void flushResults(vector<TaskResult>& staged);
+    void reportResults();
+    TimingWheel* timers();
+    void countSubmitted(unsigned long long n);
+    void retire(BaseThread& thread);
+
+    long long clockNs();
+
+    void trace(Tracer::EventT type, TaskId id, unsigned flags = 0);
+
+    void prepare(TaskRecord* record, Callable* task);
+
+    template <typename C, typename = enable_if_t<is_base_of<Callable, decay_t<C>>::value>>
+    void prepare(TaskRecord* record, C&& task);
+
+    template <typename F>
+    auto prepareTyped(TaskRecord* record, F&& f) -> future<task_result_t<decay_t<F>>>;
+
+    template <typename Result, typename F, typename... Args>
+    static void deliver(promise<Result>& result, F& f, Args&&... args);
 
 #ifdef TESTING
 
 public:
 
-    ofstream output;
+    // the trace is written there in the "id h/f/n/r/t/k" form when the pool is destroyed
+    string outputName;
 
-    void setOutput(string filename) { output = ofstream(filename); }
+    void setOutput(string filename) { outputName = filename; }
 
 #endif
 
-};
\ No newline at end of file
+};
+
+template <typename C, typename>
+ThreadPool::TaskId ThreadPool::addTask(C&& task)
+{
+    auto record = newRecord();
+
+    try
+    {
+        prepare(record, std::forward<C>(task));
+    }
+    catch (...)
+    {
+        releaseRecord(record);
+
+        throw;
+    }
+
+    return enqueue(record);
+}
+
+template <typename F>
+auto ThreadPool::submit(F&& f) -> future<task_result_t<decay_t<F>>>
+{
+    auto record = newRecord();
+
+    future<task_result_t<decay_t<F>>> res;
+
+    try
+    {
+        res = prepareTyped(record, std::forward<F>(f));
+    }
+    catch (...)
+    {
+        releaseRecord(record);
+
+        throw;
+    }
+
+    enqueue(record);
+
+    return res;
+}
+
+template <typename F>
+auto ThreadPool::submit(F&& f, Priority priority) -> future<task_result_t<decay_t<F>>>
+{
+    auto record = newRecord();
+
+    record->priority = priority;
+
+    future<task_result_t<decay_t<F>>> res;
+
+    try
+    {
+        res = prepareTyped(record, std::forward<F>(f));
+    }
+    catch (...)
+    {
+        releaseRecord(record);
+
+        throw;
+    }
+
+    enqueue(record);
+
+    return res;
+}
+
+template <typename F>
+auto ThreadPool::submit(F&& f, Deadline deadline) -> future<task_result_t<decay_t<F>>>
+{
+    auto record = newRecord();
+
+    record->deadline = boost::chrono::duration_cast<boost::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+
+    future<task_result_t<decay_t<F>>> res;
+
+    try
+    {
+        res = prepareTyped(record, std::forward<F>(f));
+    }
+    catch (...)
+    {
+        releaseRecord(record);
+
+        throw;
+    }
+
+    enqueue(record);
+
+    return res;
+}
+
+template <typename F>
+ThreadPool::TimerId ThreadPool::scheduleAfter(boost::chrono::milliseconds delay, F&& f)
+{
+    return timers()->add(Task(std::forward<F>(f)), delay.count() > 0 ? (unsigned long long)delay.count() : 0, 0);
+}
+
+template <typename F>
+ThreadPool::TimerId ThreadPool::scheduleEvery(boost::chrono::milliseconds period, F&& f)
+{
+    unsigned long long ticks = period.count() > 0 ? (unsigned long long)period.count() : 1;
+
+    return timers()->add(Task(std::forward<F>(f)), ticks, ticks);
+}
+
+template <typename Iterator>
+vector<ThreadPool::TaskId> ThreadPool::addTasks(Iterator begin, Iterator end)
+{
+    auto batch = newRecords(distance(begin, end));
+
+    vector<TaskId> ids;
+
+    ids.reserve(batch.size());
+
+    try
+    {
+        for (auto record : batch)
+        {
+            prepare(record, *begin++);
+
+            ids.push_back(record->task_id);
+        }
+    }
+    catch (...)
+    {
+        // nothing of the batch has been published yet
+        for (auto record : batch)
+        {
+            releaseRecord(record);
+        }
+
+        throw;
+    }
+
+    enqueue(batch.data(), batch.size());
+
+    return ids;
+}
+
+template <typename Iterator>
+auto ThreadPool::submitAll(Iterator begin, Iterator end) -> vector<future<task_result_t<typename iterator_traits<Iterator>::value_type>>>
+{
+    auto batch = newRecords(distance(begin, end));
+
+    vector<future<task_result_t<typename iterator_traits<Iterator>::value_type>>> res;
+
+    res.reserve(batch.size());
+
+    try
+    {
+        for (auto record : batch)
+        {
+            res.push_back(prepareTyped(record, *begin++));
+        }
+    }
+    catch (...)
+    {
+        // nothing of the batch has been published yet; the futures already made see a broken promise
+        for (auto record : batch)
+        {
+            releaseRecord(record);
+        }
+
+        throw;
+    }
+
+    enqueue(batch.data(), batch.size());
+
+    return res;
+}
+
+template <typename F>
+void ThreadPool::post(F&& f)
+{
+    auto record = newRecord();
+
+    try
+    {
+        record->work = std::forward<F>(f);
+    }
+    catch (...)
+    {
+        releaseRecord(record);
+
+        throw;
+    }
+
+    enqueue(record);
+}
+
+template <typename Iterator>
+void ThreadPool::postAll(Iterator begin, Iterator end)
+{
+    auto batch = newRecords(distance(begin, end));
+
+    try
+    {
+        for (auto record : batch)
+        {
+            record->work = *begin++;
+        }
+    }
+    catch (...)
+    {
+        for (auto record : batch)
+        {
+            releaseRecord(record);
+        }
+
+        throw;
+    }
+
+    enqueue(batch.data(), batch.size());
+}
+
+template <typename Iterator>
+size_t ThreadPool::postIdle(Iterator begin, Iterator end)
+{
+    size_t n = reserveIdle(distance(begin, end));
+
+    vector<TaskRecord*> batch;
+
+    try
+    {
+        batch = newRecords(n);
+    }
+    catch (...)
+    {
+        available += (int)n;
+
+        throw;
+    }
+
+    try
+    {
+        for (auto record : batch)
+        {
+            record->work = *begin++;
+        }
+    }
+    catch (...)
+    {
+        for (auto record : batch)
+        {
+            releaseRecord(record);
+        }
+
+        available += (int)n;
+
+        throw;
+    }
+
+    enqueue(batch.data(), batch.size(), true);
+
+    return n;
+}
+
+template <typename C, typename>
+void ThreadPool::prepare(ThreadPool::TaskRecord* record, C&& task)
+{
+    record->report = true;
+    record->work = [this, record, task = decay_t<C>(std::forward<C>(task))]() mutable { record->result = static_cast<Callable&>(task)(token(record)); };
+}
+
+template <typename F>
+auto ThreadPool::prepareTyped(ThreadPool::TaskRecord* record, F&& f) -> future<task_result_t<decay_t<F>>>
+{
+    typedef task_result_t<decay_t<F>> Result;
+
+    // the shared state comes from a slab as well, so a submit doesn't reach the heap once the pool is warm
+    promise<Result> result(allocator_arg, SlabAllocator<Result>());
+
+    auto res = result.get_future();
+
+    // the record is only captured when the task wants a token, plain lambdas stay small enough to be stored inline
+    if constexpr (is_invocable<decay_t<F>&, const CancellationToken&>::value)
+    {
+        record->work = [this, record, result = std::move(result), f = decay_t<F>(std::forward<F>(f))]() mutable { deliver(result, f, token(record)); };
+    }
+    else
+    {
+        record->work = [result = std::move(result), f = decay_t<F>(std::forward<F>(f))]() mutable { deliver(result, f); };
+    }
+
+    return res;
+}
+
+template <typename Result, typename F, typename... Args>
+void ThreadPool::deliver(promise<Result>& result, F& f, Args&&... args)
+{
+    try
+    {
+        if constexpr (is_void<Result>::value)
+        {
+            f(std::forward<Args>(args)...);
+
+            result.set_value();
+        }
+        else
+        {
+            result.set_value(f(std::forward<Args>(args)...));
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        throw; // interrupted by the pool's destructor, dropping the task breaks the promise
+    }
+    catch (...)
+    {
+        result.set_exception(current_exception());
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "ThreadPool.h"
+#include "Clock.h"
+
+// what the front ends run for "add <seconds>": sleeps that long and returns a random number
+
+class Timer : public Callable
+{
+public:
+
+    Timer(unsigned d, Clock& clock = Clock::system()) : duration(d), clock(&clock) {}
+
+    virtual int operator() (const CancellationToken& token)
+    {
+        // in short naps, so a kill ends it within one of them
+        long long end = clock->now() + duration * 1000000000LL;
+
+        while (!token.isCancelled() && clock->now() < end)
+        {
+            clock->sleepUntil(min(end, clock->now() + 10000000LL));
+        }
+
+        return rand();
+    }
+
+private:
+    unsigned duration;
+    Clock* clock;
+};
@@ -0,0 +1,261 @@
+#include <stdexcept>
+
+#include "TimingWheel.h"
+#include "ThreadPool.h"
+
+TimingWheel::TimingWheel(ThreadPool* pool)
+    :
+    pool(pool),
+    current(0),
+    armed(0),
+    start(boost::chrono::steady_clock::now()),
+    stopping(false)
+{
+    for (unsigned i = 0; i < slots; ++i)
+    {
+        wheel[i] = 0;
+    }
+
+    worker_thread = new boost::thread(boost::bind(&TimingWheel::run, this));
+}
+
+TimingWheel::~TimingWheel()
+{
+    stop();
+
+    delete worker_thread;
+}
+
+void TimingWheel::stop()
+{
+    {
+        boost::mutex::scoped_lock lock(inboxSync);
+
+        if (stopping)
+        {
+            return;
+        }
+
+        stopping = true;
+
+        inbox_ready.notify_one();
+    }
+
+    worker_thread->join();
+}
+
+TimingWheel::TimerId TimingWheel::add(Task&& work, unsigned long long delay, unsigned long long period)
+{
+    unsigned index = entries.allocate();
+
+    if (index == Slab<Entry>::none)
+    {
+        throw length_error("TimingWheel: too many timers");
+    }
+
+    auto& entry = entries[index];
+
+    unsigned generation = (unsigned)(entry.stamp_value.load() >> 32);
+
+    entry.work = std::move(work);
+    entry.deadline = now() + (long long)(delay < maxDelay ? delay : maxDelay);
+    entry.period = (long long)(period < maxDelay ? period : maxDelay);
+
+    entry.stamp_value.store(Entry::stamp(generation, Entry::ARMED));
+
+    TimerId id = (TimerId)generation << 32 | (index + 1);
+
+    rearm(index);
+
+    return id;
+}
+
+void TimingWheel::cancel(TimingWheel::TimerId id)
+{
+    unsigned index = (unsigned)(id & 0xffffffff) - 1;
+
+    if ((id & 0xffffffff) == 0 || !entries.contains(index))
+    {
+        return;
+    }
+
+    // whoever holds the entry next (wheel thread or the worker running it) sees the flag and frees it
+    auto expected = Entry::stamp((unsigned)(id >> 32), Entry::ARMED);
+
+    entries[index].stamp_value.compare_exchange_strong(expected, Entry::stamp((unsigned)(id >> 32), Entry::CANCELLED));
+}
+
+long long TimingWheel::now() const
+{
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now() - start).count();
+}
+
+void TimingWheel::run()
+{
+    vector<unsigned> arrived;
+
+    boost::unique_lock<boost::mutex> lock(inboxSync);
+
+    while (!stopping)
+    {
+        arrived.swap(inbox);
+
+        lock.unlock();
+
+        // an empty wheel doesn't tick, so it has no backlog of ticks to walk through
+        if (armed == 0)
+        {
+            current = now();
+        }
+
+        for (auto index : arrived)
+        {
+            insert(index);
+        }
+
+        arrived.clear();
+
+        for (long long target = now(); current < target; )
+        {
+            turn(++current);
+        }
+
+        lock.lock();
+
+        if (!inbox.empty() || stopping)
+        {
+            continue;
+        }
+
+        if (armed == 0)
+        {
+            inbox_ready.wait(lock);
+        }
+        else
+        {
+            inbox_ready.wait_until(lock, start + boost::chrono::milliseconds(current + 1));
+        }
+    }
+}
+
+void TimingWheel::insert(unsigned index)
+{
+    auto& entry = entries[index];
+
+    if ((entry.stamp_value.load() & 0xffffffff) == Entry::CANCELLED)
+    {
+        release(index);
+
+        return;
+    }
+
+    // overdue timers fire on the next tick
+    long long tick = max(entry.deadline, current + 1);
+
+    entry.next = wheel[tick & (slots - 1)];
+
+    wheel[tick & (slots - 1)] = index + 1;
+
+    ++armed;
+}
+
+void TimingWheel::turn(long long tick)
+{
+    unsigned link = wheel[tick & (slots - 1)];
+
+    wheel[tick & (slots - 1)] = 0;
+
+    while (link != 0)
+    {
+        unsigned index = link - 1;
+
+        auto& entry = entries[index];
+
+        link = entry.next;
+
+        if ((entry.stamp_value.load() & 0xffffffff) == Entry::CANCELLED)
+        {
+            --armed;
+
+            release(index);
+        }
+        else if (entry.deadline <= tick)
+        {
+            try
+            {
+                pool->post([this, index] { execute(index); });
+
+                --armed;
+            }
+            catch (const length_error&)
+            {
+                // every task record is taken: the timer stays armed and tries again on the next tick
+                entry.next = wheel[(tick + 1) & (slots - 1)];
+
+                wheel[(tick + 1) & (slots - 1)] = index + 1;
+            }
+        }
+        else
+        {
+            // due in a later revolution
+            entry.next = wheel[tick & (slots - 1)];
+
+            wheel[tick & (slots - 1)] = index + 1;
+        }
+    }
+}
+
+void TimingWheel::execute(unsigned index)
+{
+    auto& entry = entries[index];
+
+    if ((entry.stamp_value.load() & 0xffffffff) == Entry::CANCELLED)
+    {
+        release(index);
+
+        return;
+    }
+
+    entry.work();
+
+    if (entry.period == 0)
+    {
+        release(index);
+
+        return;
+    }
+
+    // fixed rate; firings missed while the pool was busy are skipped, not bunched up
+    long long tick = now();
+
+    entry.deadline += entry.period;
+
+    if (entry.deadline <= tick)
+    {
+        entry.deadline += ((tick - entry.deadline) / entry.period + 1) * entry.period;
+    }
+
+    rearm(index);
+}
+
+void TimingWheel::rearm(unsigned index)
+{
+    boost::mutex::scoped_lock lock(inboxSync);
+
+    inbox.push_back(index);
+
+    inbox_ready.notify_one();
+}
+
+void TimingWheel::release(unsigned index)
+{
+    auto& entry = entries[index];
+
+    entry.work.reset();
+
+    unsigned generation = (unsigned)(entry.stamp_value.load() >> 32);
+
+    entry.stamp_value.store(Entry::stamp(generation + 1, Entry::FREE));
+
+    entries.free(index);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\chrono.hpp>
+#include <boost\noncopyable.hpp>
+
+#include "Task.h"
+#include "Slab.h"
+
+class ThreadPool;
+
+// hashed timing wheel with one slot per millisecond tick
+// a timer sits in the slot of its deadline and is looked at once per revolution, so arming one is O(1)
+// whatever else is pending; a single thread turns the wheel and posts due timers to the pool,
+// instead of a worker sleeping through every delay
+
+class TimingWheel : boost::noncopyable
+{
+public:
+
+    // (generation << 32) | (slot + 1), same scheme as task ids
+    typedef unsigned long long TimerId;
+
+    static const unsigned slots = 1024;
+
+    TimingWheel(ThreadPool* pool);
+    ~TimingWheel();
+
+    // longer delays and periods are cut down to this, ms; far past any uptime, and deadlines can't overflow
+    static const unsigned long long maxDelay = 1ULL << 62;
+
+    // delay and period in ms, period 0 - fires once
+    TimerId add(Task&& work, unsigned long long delay, unsigned long long period);
+
+    // unknown, finished or stale ids are ignored; a periodic timer stops after the run in progress
+    void cancel(TimerId id);
+
+    // no more firing; timers already handed to the pool may still run
+    void stop();
+
+private:
+
+    struct Entry
+    {
+        typedef enum {
+            FREE,
+            ARMED,
+            CANCELLED,
+        } StateT;
+
+        static unsigned long long stamp(unsigned generation, StateT state) { return (unsigned long long)generation << 32 | state; }
+
+        Entry() : stamp_value(0) {}
+
+        Task work;
+
+        long long deadline; // tick
+        long long period;   // ticks
+        unsigned next;      // next entry in the same wheel slot, index + 1
+
+        boost::atomic<unsigned long long> stamp_value;
+    };
+
+    ThreadPool* pool;
+
+    Slab<Entry> entries;
+
+    // wheel thread only
+    unsigned wheel[slots];
+    long long current; // last tick processed
+    int armed;         // entries in the wheel
+
+    boost::chrono::steady_clock::time_point start;
+
+    // entries waiting to go (back) into the wheel
+    std::vector<unsigned> inbox;
+    bool stopping;
+
+    boost::mutex inboxSync;
+    boost::condition_variable inbox_ready;
+
+    boost::thread* worker_thread;
+
+    long long now() const;
+    void run();
+    void insert(unsigned index);
+    void turn(long long tick);
+    void execute(unsigned index);
+    void rearm(unsigned index);
+    void release(unsigned index);
+};
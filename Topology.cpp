@@ -0,0 +1,244 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sched.h>
+#include <pthread.h>
+#include <fstream>
+#include <string>
+#endif
+
+#include <boost\thread.hpp>
+
+#include "Topology.h"
+
+#ifdef _WIN32
+
+static std::vector<std::vector<unsigned>> detect()
+{
+    std::vector<std::vector<unsigned>> res;
+
+    DWORD_PTR process_mask = 0, system_mask = 0;
+
+    GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+
+    ULONG highest = 0;
+
+    GetNumaHighestNodeNumber(&highest);
+
+    for (ULONG node = 0; node <= highest; ++node)
+    {
+        ULONGLONG mask = 0;
+
+        if (!GetNumaNodeProcessorMask((UCHAR)node, &mask))
+        {
+            continue;
+        }
+
+        std::vector<unsigned> cpus;
+
+        for (unsigned cpu = 0; cpu < 64; ++cpu)
+        {
+            if ((mask & process_mask) >> cpu & 1)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        if (!cpus.empty())
+        {
+            res.push_back(cpus);
+        }
+    }
+
+    return res;
+}
+
+bool Topology::pin(const std::vector<unsigned>& cpus)
+{
+    DWORD_PTR mask = 0;
+
+    for (auto cpu : cpus)
+    {
+        if (cpu < 64)
+        {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+    }
+
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+int Topology::currentCpu()
+{
+    return (int)GetCurrentProcessorNumber();
+}
+
+#else
+
+// "0-3,8-11"
+static std::vector<unsigned> parseList(const std::string& list)
+{
+    std::vector<unsigned> res;
+
+    size_t pos = 0;
+
+    while (pos < list.size() && isdigit((unsigned char)list[pos]))
+    {
+        size_t end;
+
+        unsigned first = (unsigned)std::stoul(list.substr(pos), &end);
+        unsigned last = first;
+
+        pos += end;
+
+        if (pos < list.size() && list[pos] == '-')
+        {
+            last = (unsigned)std::stoul(list.substr(pos + 1), &end);
+
+            pos += end + 1;
+        }
+
+        for (unsigned cpu = first; cpu <= last; ++cpu)
+        {
+            res.push_back(cpu);
+        }
+
+        if (pos < list.size() && list[pos] == ',')
+        {
+            ++pos;
+        }
+    }
+
+    return res;
+}
+
+static std::vector<std::vector<unsigned>> detect()
+{
+    std::vector<std::vector<unsigned>> res;
+
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return res;
+    }
+
+    // node numbers can have holes
+    for (unsigned node = 0; node < 256; ++node)
+    {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+        std::string list;
+
+        if (!in || !getline(in, list))
+        {
+            continue;
+        }
+
+        std::vector<unsigned> cpus;
+
+        for (auto cpu : parseList(list))
+        {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        if (!cpus.empty())
+        {
+            res.push_back(cpus);
+        }
+    }
+
+    if (res.empty())
+    {
+        std::vector<unsigned> cpus;
+
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        if (!cpus.empty())
+        {
+            res.push_back(cpus);
+        }
+    }
+
+    return res;
+}
+
+bool Topology::pin(const std::vector<unsigned>& cpus)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+
+    for (auto cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int Topology::currentCpu()
+{
+    return sched_getcpu();
+}
+
+#endif
+
+const Topology& Topology::get()
+{
+    static Topology topology = [] {
+        Topology res;
+
+        res.nodes = detect();
+
+        if (res.nodes.empty())
+        {
+            // nothing detected: one node, cpus as counted by boost
+            res.nodes.push_back(std::vector<unsigned>());
+
+            for (unsigned cpu = 0; cpu < std::max(boost::thread::hardware_concurrency(), 1u); ++cpu)
+            {
+                res.nodes.back().push_back(cpu);
+            }
+        }
+
+        for (unsigned node = 0; node < res.nodes.size(); ++node)
+        {
+            for (auto cpu : res.nodes[node])
+            {
+                if (cpu >= res.nodeOf.size())
+                {
+                    res.nodeOf.resize(cpu + 1, -1);
+                }
+
+                res.nodeOf[cpu] = (int)node;
+            }
+        }
+
+        return res;
+    }();
+
+    return topology;
+}
+
+unsigned Topology::currentNode() const
+{
+    int cpu = currentCpu();
+
+    return cpu >= 0 && cpu < (int)nodeOf.size() && nodeOf[cpu] >= 0 ? (unsigned)nodeOf[cpu] : 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+// the CPUs this process may run on, grouped by NUMA node, plus pinning for the calling thread
+// machines (or containers) that don't expose NUMA information show up as a single node
+
+struct Topology
+{
+    std::vector<std::vector<unsigned>> nodes; // allowed cpus of every node that has any
+    std::vector<int> nodeOf;                  // cpu -> index into nodes, -1 if not allowed
+
+    static const Topology& get();
+
+    // calling thread only; false if the OS refused
+    static bool pin(const std::vector<unsigned>& cpus);
+
+    // -1 if the OS can't tell
+    static int currentCpu();
+
+    // node of the cpu the caller is on right now, 0 if unknown
+    unsigned currentNode() const;
+};
@@ -0,0 +1,186 @@
+#include <algorithm>
+
+#include "Tracer.h"
+
+thread_local Tracer::Owner Tracer::owner;
+
+Tracer::Owner::~Owner()
+{
+    if (ring != nullptr)
+    {
+        auto& reg = registry();
+
+        boost::mutex::scoped_lock lock(reg.sync);
+
+        reg.spare.push_back(ring);
+    }
+}
+
+Tracer::Registry::~Registry()
+{
+    for (auto ring : rings)
+    {
+        delete ring;
+    }
+}
+
+Tracer::Registry& Tracer::registry()
+{
+    static Registry reg;
+
+    return reg;
+}
+
+unsigned Tracer::newSource()
+{
+    static boost::atomic<unsigned> sources(0);
+
+    return ++sources;
+}
+
+void Tracer::record(unsigned source, Tracer::EventT type, unsigned long long task_id, unsigned flags, long long time, long long order)
+{
+    Ring* ring = owner.ring;
+
+    if (ring == nullptr)
+    {
+        auto& reg = registry();
+
+        boost::mutex::scoped_lock lock(reg.sync);
+
+        if (!reg.spare.empty())
+        {
+            ring = reg.spare.back();
+
+            reg.spare.pop_back();
+
+            ring->thread = reg.threads++; // a new thread, whatever the ring held before
+        }
+        else
+        {
+            ring = new Ring(reg.threads++);
+
+            reg.rings.push_back(ring);
+        }
+
+        owner.ring = ring;
+    }
+
+    unsigned long long head = ring->head.load(boost::memory_order_relaxed);
+
+    auto& event = ring->events[head % ringSize];
+
+    event.time = time;
+    event.order = order;
+    event.task_id = task_id;
+    event.source = source;
+    event.thread = ring->thread;
+    event.type = (unsigned short)type;
+    event.flags = (unsigned short)flags;
+
+    ring->head.store(head + 1, boost::memory_order_release);
+}
+
+std::vector<Tracer::Event> Tracer::collect(unsigned source)
+{
+    std::vector<Event> res;
+
+    auto& reg = registry();
+
+    boost::mutex::scoped_lock lock(reg.sync);
+
+    for (auto ring : reg.rings)
+    {
+        unsigned long long head = ring->head.load(boost::memory_order_acquire);
+        unsigned long long from = head > ringSize ? head - ringSize : 0;
+
+        std::vector<Event> copy(ring->events, ring->events + ringSize);
+
+        // whatever the writer lapped while we were copying is torn, drop it
+        unsigned long long now = ring->head.load(boost::memory_order_acquire);
+
+        from = std::max(from, now + 1 > ringSize ? now + 1 - ringSize : 0);
+
+        for (unsigned long long i = from; i < head; ++i)
+        {
+            if (copy[i % ringSize].source == source)
+            {
+                res.push_back(copy[i % ringSize]);
+            }
+        }
+    }
+
+    std::stable_sort(res.begin(), res.end(), [](const Event& a, const Event& b) { return a.time < b.time || (a.time == b.time && a.order < b.order); });
+
+    return res;
+}
+
+void Tracer::exportChrome(std::ostream& out, const std::vector<Tracer::Event>& events)
+{
+    static const char* names[] = { "submit", "assign-hot", "assign-free", "spawn", "start", "finish", "kill", "reap" };
+
+    long long origin = events.empty() ? 0 : events.front().time;
+
+    out << "{\"traceEvents\":[";
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const auto& event = events[i];
+
+        long long ns = event.time - origin;
+
+        out << (i == 0 ? "\n" : ",\n");
+
+        // a task shows up as a slice on its worker's row, everything else as an instant
+        if (event.type == START || event.type == FINISH)
+        {
+            out << "{\"name\":\"task " << event.task_id << "\",\"cat\":\"task\",\"ph\":\"" << (event.type == START ? "B" : "E") << "\"";
+        }
+        else
+        {
+            out << "{\"name\":\"" << names[event.type] << "\",\"cat\":\"pool\",\"ph\":\"i\",\"s\":\"t\"";
+        }
+
+        out << ",\"ts\":" << ns / 1000 << "." << (char)('0' + ns / 100 % 10) << (char)('0' + ns / 10 % 10) << (char)('0' + ns % 10)
+            << ",\"pid\":" << event.source << ",\"tid\":" << event.thread
+            << ",\"args\":{\"task\":" << event.task_id << ",\"flags\":" << event.flags << "}}";
+    }
+
+    out << "\n]}\n";
+}
+
+void Tracer::exportLines(std::ostream& out, const std::vector<Tracer::Event>& events)
+{
+    for (const auto& event : events)
+    {
+        char code = 0;
+
+        switch (event.type)
+        {
+        case START:
+            code = (event.flags & HOT) ? 'h' : (event.flags & HANDOFF) ? 0 : 'f';
+            break;
+
+        case SPAWN:
+            code = (event.flags & HANDOFF) ? 'n' : 0;
+            break;
+
+        case FINISH:
+            code = (event.flags & REPORTED) ? 'r' : 0;
+            break;
+
+        case KILL:
+            code = 'k';
+            break;
+
+        case REAP:
+            code = 't';
+            break;
+        }
+
+        if (code != 0)
+        {
+            out << event.task_id << " " << code << "\n";
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <ostream>
+#include <boost\atomic.hpp>
+#include <boost\thread.hpp>
+#include <boost\noncopyable.hpp>
+
+// always-on scheduling trace
+// every thread appends fixed-size binary events to a ring of its own: no lock, no allocation, just a
+// 40 byte store, the oldest events are overwritten once the ring is full. collect()
+// snapshots all rings for one pool; the exporters turn that into Chrome trace JSON (chrome://tracing,
+// Perfetto) or into the "id h/f/n/r/t/k" lines the test suites compare against
+
+class Tracer : boost::noncopyable
+{
+public:
+
+    typedef enum {
+        SUBMIT,
+        ASSIGN_HOT,
+        ASSIGN_FREE,
+        SPAWN,
+        START,
+        FINISH,
+        KILL,
+        REAP,
+    } EventT;
+
+    // event flags
+    static const unsigned HOT = 1;      // happened on (or for) a hot thread
+    static const unsigned HANDOFF = 2;  // task went straight to a newly spawned free thread
+    static const unsigned REPORTED = 4; // finished with a result for the reporter
+    static const unsigned KILLED = 8;   // finished by killTask
+
+    struct Event
+    {
+        long long time;  // ns, the pool's clock
+        long long order; // ns, steady clock: events at the same time (a virtual clock standing still) go by it
+        unsigned long long task_id;
+        unsigned source; // pool
+        unsigned thread; // thread that wrote it, never the same for two threads even if they shared a ring
+        unsigned short type;
+        unsigned short flags;
+    };
+
+    static const unsigned ringSize = 8192;
+
+    static void record(unsigned source, EventT type, unsigned long long task_id, unsigned flags, long long time, long long order);
+
+    // events of one source still in the rings, oldest first
+    static std::vector<Event> collect(unsigned source);
+
+    static void exportChrome(std::ostream& out, const std::vector<Event>& events);
+    static void exportLines(std::ostream& out, const std::vector<Event>& events);
+
+    // a fresh id for a pool's events
+    static unsigned newSource();
+
+private:
+
+    struct Ring
+    {
+        Ring(unsigned thread) : head(0), thread(thread) {}
+
+        Event events[ringSize];
+
+        boost::atomic<unsigned long long> head; // events ever written
+        unsigned thread; // current owner
+    };
+
+    // gives the ring back when its thread exits, so threads that come and go reuse rings
+    struct Owner
+    {
+        Owner() : ring(nullptr) {}
+        ~Owner();
+
+        Ring* ring;
+    };
+
+    struct Registry
+    {
+        Registry() : threads(0) {}
+        ~Registry();
+
+        std::vector<Ring*> rings;
+        std::vector<Ring*> spare;
+        unsigned threads; // ids handed out so far
+
+        boost::mutex sync;
+    };
+
+    static Registry& registry();
+
+    static thread_local Owner owner;
+};
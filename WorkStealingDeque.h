@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vector>
+#include <boost\atomic.hpp>
+#include <boost\noncopyable.hpp>
+
+// Chase-Lev work-stealing deque (memory orders after Le et al., PPoPP'13)
+// owner pushes and pops at the bottom without contention, thieves take from the top;
+// only the race for the last element ends up in a CAS
+
+template <typename Type>
+class WorkStealingDeque : boost::noncopyable
+{
+public:
+
+    WorkStealingDeque(size_t capacity = 256)
+        :
+        top(0),
+        bottom(0),
+        array(new Array(capacity))
+    {
+    }
+
+    ~WorkStealingDeque()
+    {
+        delete array.load(boost::memory_order_relaxed);
+
+        for (auto old : retired)
+        {
+            delete old;
+        }
+    }
+
+    // owner only
+    void push(const Type& val)
+    {
+        long long b = bottom.load(boost::memory_order_relaxed);
+        long long t = top.load(boost::memory_order_acquire);
+        Array* a = array.load(boost::memory_order_relaxed);
+
+        if (b - t > (long long)a->mask)
+        {
+            a = grow(a, t, b);
+        }
+
+        a->put(b, val);
+
+        boost::atomic_thread_fence(boost::memory_order_release);
+
+        bottom.store(b + 1, boost::memory_order_relaxed);
+    }
+
+    // owner only
+    bool pop(Type& val)
+    {
+        long long b = bottom.load(boost::memory_order_relaxed) - 1;
+        Array* a = array.load(boost::memory_order_relaxed);
+
+        bottom.store(b, boost::memory_order_relaxed);
+
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+        long long t = top.load(boost::memory_order_relaxed);
+
+        if (t > b)
+        {
+            bottom.store(b + 1, boost::memory_order_relaxed);
+
+            return false;
+        }
+
+        val = a->get(b);
+
+        if (t == b)
+        {
+            bool won = top.compare_exchange_strong(t, t + 1, boost::memory_order_seq_cst, boost::memory_order_relaxed);
+
+            bottom.store(b + 1, boost::memory_order_relaxed);
+
+            return won;
+        }
+
+        return true;
+    }
+
+    // any thread
+    bool steal(Type& val)
+    {
+        long long t = top.load(boost::memory_order_acquire);
+
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+        long long b = bottom.load(boost::memory_order_acquire);
+
+        if (t >= b)
+        {
+            return false;
+        }
+
+        // value is only used if we win the slot, a torn read of a recycled cell is discarded
+        Array* a = array.load(boost::memory_order_acquire);
+
+        val = a->get(t);
+
+        return top.compare_exchange_strong(t, t + 1, boost::memory_order_seq_cst, boost::memory_order_relaxed);
+    }
+
+private:
+
+    struct Array
+    {
+        Array(size_t capacity)
+        {
+            size_t size = 2;
+
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+
+            items = new Type[size];
+            mask = size - 1;
+        }
+
+        ~Array()
+        {
+            delete[] items;
+        }
+
+        Type get(long long i) const
+        {
+            return items[i & mask];
+        }
+
+        void put(long long i, const Type& val)
+        {
+            items[i & mask] = val;
+        }
+
+        Type* items;
+        size_t mask;
+    };
+
+    Array* grow(Array* old, long long t, long long b)
+    {
+        Array* bigger = new Array((old->mask + 1) * 2);
+
+        for (long long i = t; i < b; ++i)
+        {
+            bigger->put(i, old->get(i));
+        }
+
+        // thieves may still be reading the old array, keep it until the deque dies
+        retired.push_back(old);
+
+        array.store(bigger, boost::memory_order_release);
+
+        return bigger;
+    }
+
+    boost::atomic<long long> top;
+
+    char pad[64];
+
+    boost::atomic<long long> bottom;
+    boost::atomic<Array*> array;
+
+    std::vector<Array*> retired;
+};
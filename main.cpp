@@ -2,42 +2,159 @@
 #include <fstream>
 #include <string>
 #include <cassert>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <set>
+#include <map>
+#include <random>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
 #include <boost\lexical_cast.hpp>
 #include <boost\thread.hpp>
 #include <boost\algorithm\string.hpp>
 #include <boost\chrono\chrono.hpp>
 
 #include "ThreadPool.h"
+#include "TaskGraph.h"
+#include "TaskGroup.h"
+#include "Parallel.h"
+#include "Coroutine.h"
+#include "CommandReader.h"
+#include "Timer.h"
+#include "Server.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-class Timer : public Callable
+#ifdef TESTING
+
+// heap allocations made by the calling thread, for the allocation tests
+thread_local unsigned long long heap_allocations = 0;
+
+// every form of new and delete goes through these two, so each pair matches whichever form the
+// library picks; aligned blocks keep the pointer malloc returned just in front of them
+static void* counted_alloc(size_t size, size_t alignment) noexcept
+{
+    ++heap_allocations;
+
+    if (alignment <= alignof(max_align_t))
+    {
+        return malloc(size > 0 ? size : 1);
+    }
+
+    void* raw = malloc(size + alignment + sizeof(void*));
+
+    if (raw == nullptr)
+    {
+        return nullptr;
+    }
+
+    auto aligned = ((uintptr_t)raw + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+    ((void**)aligned)[-1] = raw;
+
+    return (void*)aligned;
+}
+
+static void counted_free(void* p, size_t alignment) noexcept
+{
+    if (p != nullptr && alignment > alignof(max_align_t))
+    {
+        p = ((void**)p)[-1];
+    }
+
+    free(p);
+}
+
+static void* counted_new(size_t size, size_t alignment)
+{
+    if (void* res = counted_alloc(size, alignment))
+    {
+        return res;
+    }
+
+    throw bad_alloc();
+}
+
+void* operator new(size_t size) { return counted_new(size, 0); }
+void* operator new[](size_t size) { return counted_new(size, 0); }
+void* operator new(size_t size, align_val_t al) { return counted_new(size, (size_t)al); }
+void* operator new[](size_t size, align_val_t al) { return counted_new(size, (size_t)al); }
+
+void* operator new(size_t size, const nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new(size_t size, align_val_t al, const nothrow_t&) noexcept { return counted_alloc(size, (size_t)al); }
+void* operator new[](size_t size, align_val_t al, const nothrow_t&) noexcept { return counted_alloc(size, (size_t)al); }
+
+void operator delete(void* p) noexcept { counted_free(p, 0); }
+void operator delete[](void* p) noexcept { counted_free(p, 0); }
+void operator delete(void* p, size_t) noexcept { counted_free(p, 0); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p, 0); }
+void operator delete(void* p, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete[](void* p, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete(void* p, size_t, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete[](void* p, size_t, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+
+void operator delete(void* p, const nothrow_t&) noexcept { counted_free(p, 0); }
+void operator delete[](void* p, const nothrow_t&) noexcept { counted_free(p, 0); }
+void operator delete(void* p, align_val_t al, const nothrow_t&) noexcept { counted_free(p, (size_t)al); }
+void operator delete[](void* p, align_val_t al, const nothrow_t&) noexcept { counted_free(p, (size_t)al); }
+
+typedef void(*test)();
+
+// submits a child from inside the pool and keeps its own worker busy for a while
+class Spawner : public Callable
 {
 public:
 
-    Timer(unsigned d) : duration(d) {}
+    Spawner(ThreadPool* pool, unsigned d, Clock& clock) : pool(pool), duration(d), clock(&clock) {}
 
     virtual int operator() ()
     {
-        boost::chrono::seconds sleep_time(duration);
+        pool->addTask(Timer(duration, *clock));
+
+        clock->sleepFor(500000000LL);
 
-        boost::this_thread::sleep_for(sleep_time);
-        
         return rand();
     }
 
 private:
+    ThreadPool* pool;
     unsigned duration;
+    Clock* clock;
 };
 
-#ifdef TESTING
+// sleeps for a while and returns
+class Nap : public Callable
+{
+public:
 
-typedef void(*test)();
+    Nap(unsigned ms) : duration(ms) {}
+
+    virtual int operator() ()
+    {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(duration));
+
+        return 0;
+    }
+
+private:
+    unsigned duration;
+};
 
 struct TestersAction
 {
     typedef enum {
         ADD,
+        ADD_NESTED,
+        ADD_BATCH,
         KILL,
         SLEEP,
         INITIALIZE_POOL,
@@ -46,7 +163,7 @@ struct TestersAction
     ActionsT action;
 
     union {
-        unsigned arg; // add - task duration (in seconds), kill - task id, sleep - sleep duration (in milliseconds)
+        unsigned arg; // add - task duration (in seconds), add nested - duration of the child, add batch - number of tasks (i-th lasts i + 1 seconds), kill - task id, sleep - sleep duration (in milliseconds)
         
         struct {
             unsigned N;
@@ -56,6 +173,8 @@ struct TestersAction
         };
     };
 
+    ThreadPool::Policy policy; // initialize pool
+
     TestersAction(ActionsT action, unsigned arg)
         :
         action(action),
@@ -67,7 +186,17 @@ struct TestersAction
         action(INITIALIZE_POOL),
         N(count),
         T(timeout),
-        filename(filename + ".txt")
+        filename(filename + ".txt"),
+        policy(timeout)
+    {}
+
+    TestersAction(unsigned count, const ThreadPool::Policy& policy, string filename)
+        :
+        action(INITIALIZE_POOL),
+        N(count),
+        T(policy.timeout),
+        filename(filename + ".txt"),
+        policy(policy)
     {}
 
 };
@@ -85,9 +214,9 @@ struct ThreadPoolsAction
 
     ActionsT action;
     
-    unsigned task_id;
+    ThreadPool::TaskId task_id;
 
-    ThreadPoolsAction(ActionsT action, unsigned task_id)
+    ThreadPoolsAction(ActionsT action, ThreadPool::TaskId task_id)
         :
         action(action),
         task_id(task_id)
@@ -99,7 +228,7 @@ struct ThreadPoolsAction
 
         boost::split(parts, str, boost::is_any_of(" "));
 
-        task_id = boost::lexical_cast<unsigned>(parts[0]);
+        task_id = boost::lexical_cast<ThreadPool::TaskId>(parts[0]);
 
         map< char, ActionsT > mapping = {
             { 'h', ASSIGN_TO_HOT_THREAD },
@@ -171,39 +300,71 @@ public:
 Vector<ThreadPoolsAction> run_test_case(const Vector<TestersAction>& actions)
 {
     typedef TestersAction::ActionsT ta;
-    typedef ThreadPoolsAction::ActionsT tpa;
 
     ThreadPool* pool = nullptr;
     string filename;
+
+    // simulated time: every action lands on a settled pool and sleeping costs no real time
+    VirtualClock clock;
     
     for (const auto& action : actions)
     {
         switch (action.action)
         {
         case ta::INITIALIZE_POOL:
-            pool = new ThreadPool(action.N, action.T);
+        {
+            auto policy = action.policy;
+
+            policy.clock = &clock;
+
+            pool = new ThreadPool(action.N, policy);
             pool->setOutput(action.filename);
             filename = action.filename;
 
             break;
+        }
     
         case ta::ADD:
-            pool->addTask(new Timer(action.arg));
+            pool->addTask(Timer(action.arg, clock));
             
             break;
 
+        case ta::ADD_NESTED:
+            pool->addTask(Spawner(pool, action.arg, clock));
+
+            break;
+
+        case ta::ADD_BATCH:
+        {
+            vector<Timer> batch;
+
+            for (unsigned i = 0; i < action.arg; ++i)
+            {
+                batch.push_back(Timer(i + 1, clock));
+            }
+
+            pool->addTasks(batch.begin(), batch.end());
+
+            break;
+        }
+
         case ta::KILL:
             pool->killTask(action.arg);
 
             break;
 
         case ta::SLEEP:
-            boost::this_thread::sleep_for(boost::chrono::milliseconds(action.arg));
+            clock.advance(action.arg * 1000000LL);
 
             break;
         }
+
+        clock.settle();
     }
 
+    // idle workers are let go, tasks still sleeping are killed by the destructor's interrupt
+    clock.release();
+
     delete pool;
 
     ifstream in(filename);
@@ -380,111 +541,1635 @@ void free_threads_tests()
         .push_back(TestersAction(ta::SLEEP, 3000))
         ;
 
+    // tasks 3 and 4 reuse the slots of 2 and 1 (last freed first), one generation later
+    ThreadPool::TaskId third = 1ull << 32 | 2, fourth = 1ull << 32 | 1;
+
     expected
         .push_back(ThreadPoolsAction(tpa::CREATE_FREE_THREAD, 1))
         .push_back(ThreadPoolsAction(tpa::CREATE_FREE_THREAD, 2))
         .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 1))
         .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 2))
-        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_FREE_THREAD, 3))
-        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_FREE_THREAD, 4))
-        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 3))
-        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 4))
-        .push_back(ThreadPoolsAction(tpa::TERMINATE_FREE_THREAD, 3))
-        .push_back(ThreadPoolsAction(tpa::TERMINATE_FREE_THREAD, 4))
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_FREE_THREAD, third))
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_FREE_THREAD, fourth))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, third))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, fourth))
+        .push_back(ThreadPoolsAction(tpa::TERMINATE_FREE_THREAD, third))
+        .push_back(ThreadPoolsAction(tpa::TERMINATE_FREE_THREAD, fourth))
         ;
     END_TESTCASE_DESCRIPTION;
     
     run_tests(tests, "free threads");
 }
 
-void kill_tasks_tests()
+void elastic_policy_tests()
 {
     vector<TestCase> tests;
 
+    ThreadPool::Policy capped(1);
+
+    capped.maxFreeThreads = 1;
+
     START_TESTCASE_DESCRIPTION;
     actions
-        .push_back(TestersAction(1, 1, "kill_tasks_1"))
-        .push_back(TestersAction(ta::ADD, 3))
+        .push_back(TestersAction(0, capped, "elastic_policy_1"))
+        .push_back(TestersAction(ta::ADD, 1))
+        .push_back(TestersAction(ta::ADD, 1)) // over the cap, waits in the queue
         .push_back(TestersAction(ta::SLEEP, 300))
-        .push_back(TestersAction(ta::KILL, 1))
-    ;
+        .push_back(TestersAction(ta::KILL, 2))
+        .push_back(TestersAction(ta::SLEEP, 1000))
+        ;
+
+    expected
+        .push_back(ThreadPoolsAction(tpa::CREATE_FREE_THREAD, 1))
+        .push_back(ThreadPoolsAction(tpa::KILL_TASK, 2))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 1))
+        ;
+    END_TESTCASE_DESCRIPTION;
+
+    ThreadPool::Policy spare(1);
+
+    spare.warmSpares = 1;
+
+    START_TESTCASE_DESCRIPTION;
+    actions
+        .push_back(TestersAction(0, spare, "elastic_policy_2"))
+        .push_back(TestersAction(ta::SLEEP, 100))
+        .push_back(TestersAction(ta::ADD, 1)) // runs on the spare
+        .push_back(TestersAction(ta::SLEEP, 2500)) // spare outlives its timeout
+        ;
+
+    expected
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_FREE_THREAD, 1))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 1))
+        ;
+    END_TESTCASE_DESCRIPTION;
+
+    run_tests(tests, "elastic policy");
+}
+
+void work_stealing_tests()
+{
+    vector<TestCase> tests;
+
+    START_TESTCASE_DESCRIPTION;
+    actions
+        .push_back(TestersAction(2, 1, "work_stealing_1"))
+        .push_back(TestersAction(ta::ADD_NESTED, 1))
+        .push_back(TestersAction(ta::SLEEP, 1250))
+        ;
 
     expected
         .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_HOT_THREAD, 1))
-        .push_back(ThreadPoolsAction(tpa::KILL_TASK, 1))
-    ;
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_HOT_THREAD, 2))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 1))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 2))
+        ;
     END_TESTCASE_DESCRIPTION;
 
+    run_tests(tests, "work stealing");
+
+    // the only hot thread waits on its own child: with nobody idle to steal the child it gets a free thread
+    ThreadPool pool(1, 1);
+
+    auto outer = pool.submit([&pool] { return pool.submit([] { return 41; }).get() + 1; });
+
+    bool passed = outer.wait_for(std::chrono::seconds(5)) == future_status::ready && outer.get() == 42;
+
+    cout << (passed ? "work stealing#2 passed\n" : "Failed work stealing#2\n");
+}
+
+void batch_tests()
+{
+    vector<TestCase> tests;
+
     START_TESTCASE_DESCRIPTION;
     actions
-        .push_back(TestersAction(0, 1, "kill_tasks_1"))
-        .push_back(TestersAction(ta::ADD, 3))
-        .push_back(TestersAction(ta::SLEEP, 300))
-        .push_back(TestersAction(ta::KILL, 1))
-        .push_back(TestersAction(ta::SLEEP, 10000))
-    ;
+        .push_back(TestersAction(1, 1, "batch_1"))
+        .push_back(TestersAction(ta::SLEEP, 100))
+        .push_back(TestersAction(ta::ADD_BATCH, 2)) // one for the idle hot thread, the other gets a free thread
+        .push_back(TestersAction(ta::SLEEP, 2500))
+        ;
 
     expected
-        .push_back(ThreadPoolsAction(tpa::CREATE_FREE_THREAD, 1))
-        .push_back(ThreadPoolsAction(tpa::KILL_TASK, 1))
-        .push_back(ThreadPoolsAction(tpa::TERMINATE_FREE_THREAD, 1))
-    ;
+        .push_back(ThreadPoolsAction(tpa::CREATE_FREE_THREAD, 2))
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_HOT_THREAD, 1))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 1))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 2))
+        ;
     END_TESTCASE_DESCRIPTION;
 
-    run_tests(tests, "kill tasks");
+    run_tests(tests, "batch");
+
+    ThreadPool pool(4, 1);
+
+    vector<function<int()>> work;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        work.push_back([i] { return i; });
+    }
+
+    auto results = pool.submitAll(work.begin(), work.end());
+
+    int sum = 0;
+
+    for (auto& result : results)
+    {
+        sum += result.get();
+    }
+
+    cout << (results.size() == 100 && sum == 4950 ? "batch#2 passed\n" : "Failed batch#2\n");
 }
 
-#endif
+void priorities_tests()
+{
+    ThreadPool::Policy policy;
 
-int main(int argc, char** argv)
+    policy.maxFreeThreads = 0; // single worker, everything below queues behind the blocker
+
+    ThreadPool pool(1, policy);
+
+    boost::atomic<bool> started(false);
+
+    auto blocker = pool.submit([&started] {
+        started = true;
+
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(300));
+    });
+
+    while (!started)
+    {
+        boost::this_thread::yield();
+    }
+
+    string order;
+
+    auto now = boost::chrono::steady_clock::now();
+
+    vector<future<void>> done;
+
+    done.push_back(pool.submit([&order] { order += 'l'; }, ThreadPool::LOW));
+    done.push_back(pool.submit([&order] { order += 'n'; }));
+    done.push_back(pool.submit([&order] { order += 'h'; }, ThreadPool::HIGH));
+    done.push_back(pool.submit([&order] { order += 'd'; }, now + boost::chrono::seconds(2)));
+    done.push_back(pool.submit([&order] { order += 'e'; }, now + boost::chrono::seconds(1)));
+
+    for (auto& i : done)
+    {
+        i.get();
+    }
+
+    cout << (order == "edhnl" ? "priorities#1 passed\n" : "Failed priorities#1\n");
+}
+
+void graph_tests()
 {
-#ifndef TESTING
+    ThreadPool pool(2, 1);
 
-    int N = boost::lexical_cast<int>(argv[1]);
-    int T = boost::lexical_cast<int>(argv[2]);
+    // diamond: a before b and c, both before d
+    boost::atomic<int> clock(0);
+    int a = 0, b = 0, c = 0, d = 0;
 
-    ThreadPool pool(N, T);
+    TaskGraph graph;
+
+    auto na = graph.add([&] { a = ++clock; });
+    auto nb = graph.add([&] { b = ++clock; });
+    auto nc = graph.add([&] { c = ++clock; });
+    auto nd = graph.add([&] { d = ++clock; });
+
+    graph.precede(na, nb);
+    graph.precede(na, nc);
+    graph.precede(nb, nd);
+    graph.precede(nc, nd);
+
+    graph.run(pool).get();
+
+    bool passed = a == 1 && b > a && c > a && d == 4;
+
+    // same graph again, counters are rearmed on every run
+    graph.run(pool).get();
+
+    passed = passed && a == 5 && d == 8;
+
+    cout << (passed ? "graph#1 passed\n" : "Failed graph#1\n");
+
+    TaskGraph failing;
+
+    bool skipped = true;
+
+    auto boom = failing.add([] { throw runtime_error("boom"); });
+    auto after = failing.add([&skipped] { skipped = false; });
+
+    failing.precede(boom, after);
+
+    try
+    {
+        failing.run(pool).get();
 
-    while (1)
+        cout << "Failed graph#2\n";
+    }
+    catch (runtime_error&)
     {
-        string cmd;
+        cout << (skipped ? "graph#2 passed\n" : "Failed graph#2\n");
+    }
 
-        getline(cin, cmd);
+    TaskGraph cycle;
 
-        vector<string> parts;
+    auto x = cycle.add([] {});
+    auto y = cycle.add([] {});
 
-        boost::split(parts, cmd, boost::is_any_of(" "));
+    cycle.precede(x, y);
+    cycle.precede(y, x);
 
-        string command = parts[0];
+    try
+    {
+        cycle.run(pool);
 
-        if (parts.size() > 1)
-        {
-            int param = boost::lexical_cast<int>(parts[1]);
+        cout << "Failed graph#3\n";
+    }
+    catch (logic_error&)
+    {
+        cout << "graph#3 passed\n";
+    }
+}
 
-            if (command == "add")
-            {
-                pool.addTask(new Timer(param));
-            }
-            else if (command == "kill")
-            {
-                pool.killTask(param);
-            }
+void group_tests()
+{
+    {
+        ThreadPool pool(2, 1);
+
+        TaskGroup group(pool);
+
+        boost::atomic<int> sum(0);
+
+        // fan out from inside the group as well
+        for (int i = 0; i < 10; ++i)
+        {
+            group.run([&group, &sum, i] {
+                for (int j = 0; j < 10; ++j)
+                {
+                    group.run([&sum, i, j] { sum += i * 10 + j; });
+                }
+            });
         }
-        else
+
+        bool completed = group.wait();
+
+        cout << (completed && sum == 4950 ? "group#1 passed\n" : "Failed group#1\n");
+    }
+
+    ThreadPool::Policy policy;
+
+    policy.maxFreeThreads = 0; // single worker, the group queues behind whatever keeps it busy
+
+    ThreadPool pool(1, policy);
+
+    boost::atomic<bool> started(false);
+    boost::atomic<bool> release(false);
+
+    pool.post([&started, &release] {
+        started = true;
+
+        while (!release)
         {
-            if (command == "exit")
+            boost::this_thread::yield();
+        }
+    });
+
+    while (!started)
+    {
+        boost::this_thread::yield();
+    }
+
+    // the worker is taken, so the waiter runs all of it
+    TaskGroup group(pool);
+
+    boost::atomic<int> helped(0);
+
+    auto self = boost::this_thread::get_id();
+
+    for (int i = 0; i < 10; ++i)
+    {
+        group.run([&helped, self] {
+            if (boost::this_thread::get_id() == self)
             {
-                break;
+                ++helped;
             }
+        });
+    }
+
+    bool passed = group.wait() && helped == 10;
+
+    release = true;
+
+    cout << (passed ? "group#2 passed\n" : "Failed group#2\n");
+
+    // one running until cancelled, the rest dropped before they start
+    boost::atomic<bool> running(false);
+    boost::atomic<int> ran(0);
+
+    group.run([&running](const CancellationToken& token) {
+        running = true;
+
+        while (!token.isCancelled())
+        {
+            boost::this_thread::yield();
         }
+    });
+
+    while (!running)
+    {
+        boost::this_thread::yield();
     }
 
-#else
+    for (int i = 0; i < 10; ++i)
+    {
+        group.run([&ran] { ++ran; });
+    }
 
-    vector<test> tests = {
-       // hot_threads_tests,
-      //  free_threads_tests,
-        kill_tasks_tests
+    group.cancel();
+
+    group.run([&ran] { ++ran; }); // cancelled until the wait is over
+
+    passed = !group.wait() && ran == 0;
+
+    // usable again
+    group.run([&ran] { ++ran; });
+
+    passed = passed && group.wait() && ran == 1;
+
+    cout << (passed ? "group#3 passed\n" : "Failed group#3\n");
+
+    bool again = false;
+
+    group.run([] { throw runtime_error("boom"); });
+
+    try
+    {
+        group.wait();
+
+        cout << "Failed group#4\n";
+    }
+    catch (runtime_error&)
+    {
+        group.run([&again] { again = true; });
+
+        cout << (group.wait() && again ? "group#4 passed\n" : "Failed group#4\n");
+    }
+}
+
+void parallel_tests()
+{
+    ThreadPool pool(3, 1);
+
+    bool passed = true;
+
+    for (auto partition : { STATIC_PARTITION, GUIDED_PARTITION, AUTO_PARTITION })
+    {
+        vector<int> doubled(10000, -1);
+
+        parallel_for(pool, 0, 10000, [&doubled](int i) { doubled[i] = 2 * i; }, partition);
+
+        for (int i = 0; i < 10000; ++i)
+        {
+            passed = passed && doubled[i] == 2 * i;
+        }
+    }
+
+    cout << (passed ? "parallel#1 passed\n" : "Failed parallel#1\n");
+
+    auto sum = parallel_reduce(pool, 0LL, 100000LL, 0LL,
+        [](long long first, long long last, long long partial) {
+            for (auto i = first; i < last; ++i)
+            {
+                partial += i;
+            }
+
+            return partial;
+        },
+        [](long long a, long long b) { return a + b; });
+
+    cout << (sum == 100000LL * 99999 / 2 ? "parallel#2 passed\n" : "Failed parallel#2\n");
+
+    vector<int> values(100000);
+
+    for (auto& i : values)
+    {
+        i = rand();
+    }
+
+    auto expected = values;
+
+    sort(expected.begin(), expected.end());
+
+    parallel_sort(pool, values.begin(), values.end());
+
+    cout << (values == expected ? "parallel#3 passed\n" : "Failed parallel#3\n");
+
+    // the only hot thread is busy: the caller does it all, no free thread is started for helpers
+    ThreadPool busy(1, 1);
+
+    boost::atomic<bool> started(false);
+    boost::atomic<bool> release(false);
+
+    busy.post([&started, &release] {
+        started = true;
+
+        while (!release)
+        {
+            boost::this_thread::yield();
+        }
+    });
+
+    while (!started)
+    {
+        boost::this_thread::yield();
+    }
+
+    vector<int> squares(1000, -1);
+
+    parallel_for(busy, 0, 1000, [&squares](int i) { squares[i] = i * i; });
+
+    passed = busy.stats().freeThreads == 0;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        passed = passed && squares[i] == i * i;
+    }
+
+    release = true;
+
+    cout << (passed ? "parallel#4 passed\n" : "Failed parallel#4\n");
+}
+
+#ifdef COROUTINES
+
+CoTask<int> co_square(ThreadPool& pool, int x)
+{
+    co_await pool.schedule();
+
+    co_return x * x;
+}
+
+CoTask<int> co_sum_of_squares(ThreadPool& pool, int n)
+{
+    int sum = 0;
+
+    for (int i = 0; i < n; ++i)
+    {
+        sum += co_await co_square(pool, i);
+    }
+
+    co_return sum;
+}
+
+CoTask<void> co_fail(ThreadPool& pool)
+{
+    co_await pool.schedule();
+
+    throw runtime_error("boom");
+}
+
+void coroutine_tests()
+{
+    ThreadPool pool(2, 1);
+
+    cout << (start_task(co_sum_of_squares(pool, 10)).get() == 285 ? "coroutines#1 passed\n" : "Failed coroutines#1\n");
+
+    // far more logical operations in flight than there are threads
+    vector<future<int>> flying;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        flying.push_back(start_task(co_square(pool, i % 10)));
+    }
+
+    int sum = 0;
+
+    for (auto& i : flying)
+    {
+        sum += i.get();
+    }
+
+    cout << (sum == 28500 ? "coroutines#2 passed\n" : "Failed coroutines#2\n");
+
+    try
+    {
+        start_task(co_fail(pool)).get();
+
+        cout << "Failed coroutines#3\n";
+    }
+    catch (runtime_error&)
+    {
+        cout << "coroutines#3 passed\n";
+    }
+}
+
+#endif
+
+void timer_tests()
+{
+    ThreadPool pool(1, 1);
+
+    auto start = boost::chrono::steady_clock::now();
+
+    boost::atomic<long long> fired_after(-1);
+
+    pool.scheduleAfter(boost::chrono::milliseconds(100), [&fired_after, start] {
+        fired_after = boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now() - start).count();
+    });
+
+    boost::atomic<bool> cancelled_fired(false);
+
+    pool.cancelTimer(pool.scheduleAfter(boost::chrono::milliseconds(100), [&cancelled_fired] { cancelled_fired = true; }));
+
+    boost::atomic<int> ticks(0);
+
+    auto every = pool.scheduleEvery(boost::chrono::milliseconds(50), [&ticks] { ++ticks; });
+
+    // past UINT_MAX ms: due in some 50 days, not 100 ms from now
+    boost::atomic<bool> far_fired(false);
+
+    auto far = pool.scheduleAfter(boost::chrono::milliseconds(4294967296LL + 100), [&far_fired] { far_fired = true; });
+
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(600));
+
+    pool.cancelTimer(every);
+
+    int seen = ticks;
+
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+
+    bool passed = fired_after >= 100 && !cancelled_fired && seen >= 5 && ticks <= seen + 1;
+
+    cout << (passed ? "timers#1 passed\n" : "Failed timers#1\n");
+
+    pool.cancelTimer(far);
+
+    cout << (!far_fired ? "timers#3 passed\n" : "Failed timers#3\n");
+
+    // lots of pending timers, no thread held by any of them
+    boost::atomic<int> done(0);
+
+    for (int i = 0; i < 100000; ++i)
+    {
+        pool.scheduleAfter(boost::chrono::milliseconds(200 + i % 300), [&done] { ++done; });
+    }
+
+    for (int i = 0; i < 100 && done < 100000; ++i)
+    {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    }
+
+    cout << (done == 100000 ? "timers#2 passed\n" : "Failed timers#2\n");
+}
+
+void result_sink_tests()
+{
+    stringstream text;
+
+    {
+        ResultSink sink(text);
+
+        sink.write(1, 42);
+        sink.write(1ull << 32 | 7, -5);
+    }
+
+    cout << (text.str() == "1 42\n4294967303 -5\n" ? "result sink#1 passed\n" : "Failed result sink#1\n");
+
+    stringstream binary;
+
+    {
+        ResultSink sink(binary, ResultSink::BINARY);
+
+        for (int i = 0; i < 10000; ++i) // several buffers' worth
+        {
+            sink.write(i, -i);
+        }
+    }
+
+    string bytes = binary.str();
+
+    bool passed = bytes.size() == 10000 * 12;
+
+    for (int i = 0; i < 10000 && passed; ++i)
+    {
+        unsigned long long id = 0;
+        uint32_t value = 0;
+
+        for (int j = 0; j < 8; ++j)
+        {
+            id |= (unsigned long long)(unsigned char)bytes[i * 12 + j] << (8 * j);
+        }
+
+        for (int j = 0; j < 4; ++j)
+        {
+            value |= (uint32_t)(unsigned char)bytes[i * 12 + 8 + j] << (8 * j);
+        }
+
+        passed = id == (unsigned long long)i && (int)value == -i;
+    }
+
+    cout << (passed ? "result sink#2 passed\n" : "Failed result sink#2\n");
+
+    // a quick result between two slow tasks on one worker goes out before the second slow one ends
+    ThreadPool::Policy policy;
+
+    policy.maxFreeThreads = 0;
+
+    ThreadPool pool(1, policy);
+
+    auto start = boost::chrono::steady_clock::now();
+
+    boost::mutex sync;
+    map<ThreadPool::TaskId, long long> delivered; // ms after start
+
+    pool.setResultHandler([&](const ThreadPool::TaskResult* results, size_t n) {
+        boost::mutex::scoped_lock lock(sync);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            delivered[results[i].task_id] = boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::steady_clock::now() - start).count();
+        }
+    });
+
+    pool.addTask(new Nap(300));
+
+    auto quick = pool.addTask(new Nap(0));
+    auto last = pool.addTask(new Nap(300));
+
+    while (true)
+    {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+
+        boost::mutex::scoped_lock lock(sync);
+
+        if (delivered.count(last) > 0)
+        {
+            break;
+        }
+    }
+
+    pool.setResultHandler(nullptr);
+
+    cout << (delivered[quick] < 450 ? "result sink#3 passed\n" : "Failed result sink#3\n");
+}
+
+void tracer_tests()
+{
+    stringstream trace;
+
+    {
+        ThreadPool pool(2, 1);
+
+        vector<future<int>> done;
+
+        for (int i = 0; i < 10; ++i)
+        {
+            done.push_back(pool.submit([i] { return i; }));
+        }
+
+        for (auto& i : done)
+        {
+            i.get();
+        }
+
+        pool.exportTrace(trace);
+    }
+
+    string json = trace.str();
+
+    auto occurrences = [&json](const string& what) {
+        size_t n = 0;
+
+        for (size_t pos = json.find(what); pos != string::npos; pos = json.find(what, pos + 1))
+        {
+            ++n;
+        }
+
+        return n;
+    };
+
+    // every task is one slice on its worker's row
+    bool passed = json.find("{\"traceEvents\":[") == 0 && occurrences("\"ph\":\"B\"") == 10 && occurrences("\"ph\":\"E\"") == 10 && occurrences("\"submit\"") == 10;
+
+    cout << (passed ? "tracer#1 passed\n" : "Failed tracer#1\n");
+
+    // timestamps come from the pool's clock: one that never moves puts everything at the origin
+    stringstream frozen;
+
+    {
+        VirtualClock clock;
+
+        ThreadPool::Policy policy;
+
+        policy.clock = &clock;
+
+        ThreadPool pool(1, policy);
+
+        pool.submit([] { return 0; }).get();
+
+        clock.settle();
+
+        pool.exportTrace(frozen);
+
+        clock.release();
+    }
+
+    json = frozen.str();
+
+    passed = occurrences("\"ph\":\"B\"") == 1 && occurrences("\"ts\":") == occurrences("\"ts\":0.000,");
+
+    cout << (passed ? "tracer#2 passed\n" : "Failed tracer#2\n");
+
+    // a thread that takes over a ring left by another one shows up as a thread of its own
+    auto source = Tracer::newSource();
+
+    for (int i = 0; i < 2; ++i)
+    {
+        boost::thread([source, i] { Tracer::record(source, Tracer::SUBMIT, i, 0, 0, 0); }).join();
+    }
+
+    auto events = Tracer::collect(source);
+
+    cout << (events.size() == 2 && events[0].thread != events[1].thread ? "tracer#3 passed\n" : "Failed tracer#3\n");
+}
+
+void stats_tests()
+{
+    bool passed = true;
+
+    // every bucket's upper edge maps back to it, and the edges only grow
+    for (unsigned i = 0; i < Histogram::buckets; ++i)
+    {
+        passed = passed && Histogram::bucket(Histogram::highest(i)) == i && (i == 0 || Histogram::highest(i) > Histogram::highest(i - 1));
+    }
+
+    Histogram histogram;
+
+    for (unsigned long long i = 1; i <= 1000; ++i)
+    {
+        histogram.add(i * 1000);
+    }
+
+    auto median = histogram.percentile(50);
+
+    passed = passed && histogram.count() == 1000 && median >= 500000 && median <= 500000 * 9 / 8;
+
+    cout << (passed ? "stats#1 passed\n" : "Failed stats#1\n");
+
+    ThreadPool::Policy policy;
+
+    policy.maxFreeThreads = 0;
+
+    ThreadPool pool(2, policy);
+
+    for (int i = 0; i < 50; ++i)
+    {
+        pool.submit([] { boost::this_thread::sleep_for(boost::chrono::milliseconds(1)); });
+    }
+
+    ThreadPool::Stats stats;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        stats = pool.stats();
+
+        if (stats.completed == 50)
+        {
+            break;
+        }
+
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    }
+
+    unsigned long long busy = 0;
+
+    for (auto& worker : stats.workers)
+    {
+        busy += worker.busy;
+    }
+
+    passed = stats.submitted == 50 && stats.completed == 50 && stats.killed == 0 && stats.queued == 0
+        && stats.workers.size() == 2 && stats.hotThreads == 2 && stats.freeThreads == 0
+        && stats.wait.count() == 50 && stats.run.count() == 50 && stats.run.percentile(50) >= 1000000 && busy >= 50000000;
+
+    cout << (passed ? "stats#2 passed\n" : "Failed stats#2\n");
+}
+
+void placement_tests()
+{
+    const auto& topology = Topology::get();
+
+    ThreadPool::Policy policy;
+
+    policy.maxFreeThreads = 0; // hot threads only, those are the pinned ones
+    policy.placement = ThreadPool::PIN_CORES;
+
+    set<int> pinned;
+
+    for (unsigned node = 0, n = 0; node < topology.nodes.size(); ++node)
+    {
+        for (size_t i = 0; i < topology.nodes[node].size() && n < 2; ++i, ++n)
+        {
+            pinned.insert(topology.nodes[node][i]);
+        }
+    }
+
+    bool passed = true;
+
+    {
+        ThreadPool pool(2, policy);
+
+        vector<future<int>> cpus;
+
+        for (int i = 0; i < 100; ++i)
+        {
+            cpus.push_back(pool.submit([] { return Topology::currentCpu(); }));
+        }
+
+        for (auto& i : cpus)
+        {
+            passed = passed && pinned.count(i.get()) == 1;
+        }
+
+        // ids carry the node, killing by id still finds the record
+        auto id = pool.addTask(Timer(1));
+
+        pool.killTask(id);
+    }
+
+    cout << (passed ? "placement#1 passed\n" : "Failed placement#1\n");
+
+    policy.placement = ThreadPool::SPREAD_NODES;
+
+    {
+        ThreadPool pool(4, policy);
+
+        vector<int> values(1000);
+
+        parallel_for(pool, 0, 1000, [&values](int i) { values[i] = i; });
+
+        passed = true;
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            passed = passed && values[i] == i;
+        }
+    }
+
+    cout << (passed ? "placement#2 passed\n" : "Failed placement#2\n");
+}
+
+void idle_tests()
+{
+    EventCount event;
+
+    // nobody notifies: the wait times out
+    unsigned key = event.prepareWait();
+
+    bool passed = !event.wait(key, 20) && event.waiters() == 0;
+
+    // a notify after prepareWait is never lost, whether it lands before or during the wait
+    key = event.prepareWait();
+
+    event.notify(1);
+
+    passed = passed && event.wait(key, 1000);
+
+    boost::atomic<bool> woken(false);
+
+    boost::thread waiter([&event, &woken] {
+        unsigned key = event.prepareWait();
+
+        woken = event.wait(key, 5000);
+    });
+
+    while (event.waiters() == 0)
+    {
+        boost::this_thread::yield();
+    }
+
+    event.notifyAll();
+
+    waiter.join();
+
+    passed = passed && woken;
+
+    cout << (passed ? "idle#1 passed\n" : "Failed idle#1\n");
+
+    // back to back round trips, each one finds the worker idle: spinning, then parked every time
+    passed = true;
+
+    for (int spin : { 2000, 0 })
+    {
+        ThreadPool::Policy policy;
+
+        policy.maxFreeThreads = 0;
+        policy.spinCount = spin;
+        policy.yieldCount = spin == 0 ? 0 : 16;
+
+        ThreadPool pool(2, policy);
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            passed = passed && pool.submit([i] { return i; }).get() == i;
+        }
+    }
+
+    cout << (passed ? "idle#2 passed\n" : "Failed idle#2\n");
+}
+
+void cancellation_tests()
+{
+    ThreadPool::Policy policy;
+
+    policy.maxFreeThreads = 0; // a single hot thread and nothing else, killing must not cost it
+
+    bool passed = true;
+
+    {
+        ThreadPool pool(1, policy);
+
+        auto start = boost::chrono::steady_clock::now();
+
+        auto id = pool.addTask(Timer(10));
+
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+
+        pool.killTask(id);
+
+        // the same worker takes the next task as soon as the timer notices
+        passed = pool.submit([] { return 7; }).get() == 7 && boost::chrono::steady_clock::now() - start < boost::chrono::seconds(2);
+
+        auto stats = pool.stats();
+
+        passed = passed && stats.killed == 1 && stats.completed == 1 && stats.hotThreads == 1 && stats.freeThreads == 0;
+    }
+
+    cout << (passed ? "cancellation#1 passed\n" : "Failed cancellation#1\n");
+
+    // typed tasks take the token as an argument; the pool going away cancels whatever still runs
+    future<int> spins;
+
+    {
+        ThreadPool pool(1, policy);
+
+        boost::atomic<bool> running(false);
+
+        spins = pool.submit([&running](const CancellationToken& token) {
+            int res = 0;
+
+            running = true;
+
+            while (!token.isCancelled())
+            {
+                ++res;
+
+                boost::this_thread::yield();
+            }
+
+            return res;
+        });
+
+        while (!running)
+        {
+            boost::this_thread::yield();
+        }
+    }
+
+    passed = spins.get() > 0 && !CancellationToken().isCancelled();
+
+    cout << (passed ? "cancellation#2 passed\n" : "Failed cancellation#2\n");
+}
+
+void typed_tasks_tests()
+{
+    ThreadPool pool(2, 1);
+
+    auto sum = pool.submit([] { return 2 + 2; });
+    auto text = pool.submit([] { return string("done"); });
+
+    bool ran = false;
+
+    auto nothing = pool.submit([&ran] { ran = true; });
+
+    nothing.get();
+
+    bool passed = sum.get() == 4 && text.get() == "done" && ran;
+
+    cout << (passed ? "typed tasks#1 passed\n" : "Failed typed tasks#1\n");
+
+    auto failing = pool.submit([]() -> int { throw runtime_error("boom"); });
+
+    try
+    {
+        failing.get();
+
+        cout << "Failed typed tasks#2\n";
+    }
+    catch (runtime_error&)
+    {
+        cout << "typed tasks#2 passed\n";
+    }
+}
+
+void allocations_tests()
+{
+    ThreadPool pool(1, 1);
+
+    auto run = [&pool](int n) {
+        for (int i = 0; i < n; ++i)
+        {
+            pool.submit([i] { return i; }).get();
+        }
+    };
+
+    run(100);
+
+    auto warm = pool.allocations();
+
+    run(5000);
+
+    cout << (pool.allocations() == warm ? "allocations#1 passed\n" : "Failed allocations#1\n");
+
+    // a full slab fails allocations instead of running off its chunk table, and recovers once something is freed
+    unique_ptr<Slab<int>> slab(new Slab<int>());
+
+    unsigned batch[4];
+
+    bool passed = slab->allocate(4, batch);
+
+    for (unsigned i = 4; i < Slab<int>::capacity - 2; ++i)
+    {
+        passed = passed && slab->allocate() == i;
+    }
+
+    slab->free(batch[0]);
+
+    // one recycled index and two fresh ones aren't enough for four, the recycled one stays free
+    passed = passed && !slab->allocate(4, batch) && slab->allocate(3, batch);
+
+    passed = passed && slab->allocate() == Slab<int>::none && slab->allocations() == Slab<int>::maxChunks;
+
+    slab->free(batch[1]);
+
+    passed = passed && slab->allocate() == batch[1];
+
+    cout << (passed ? "allocations#2 passed\n" : "Failed allocations#2\n");
+
+    // nor does a submit itself allocate anything: record, promise state and callable all come from slabs
+    auto before = heap_allocations;
+
+    run(1000);
+
+    cout << (heap_allocations == before ? "allocations#3 passed\n" : "Failed allocations#3\n");
+}
+
+// random actions on a random pool; in simulated time a seed has to replay to the same trace every time
+Vector<TestersAction> random_test_case(unsigned seed)
+{
+    mt19937 random(seed);
+
+    ThreadPool::Policy policy(1 + random() % 3);
+
+    if (random() % 4 == 0)
+    {
+        policy.maxFreeThreads = random() % 3;
+    }
+
+    Vector<TestersAction> actions;
+
+    actions.push_back(TestersAction(random() % 3, policy, "stress"));
+
+    unsigned added = 0;
+
+    for (unsigned i = 0, n = 5 + random() % 20; i < n; ++i)
+    {
+        switch (random() % 5)
+        {
+        case 0:
+        case 1:
+            actions.push_back(TestersAction(ta::ADD, random() % 3));
+            ++added;
+            break;
+
+        case 2:
+            actions.push_back(TestersAction(ta::ADD_NESTED, random() % 2));
+            added += 2;
+            break;
+
+        case 3:
+            actions.push_back(TestersAction(ta::SLEEP, random() % 1500));
+            break;
+
+        case 4:
+            actions.push_back(TestersAction(ta::KILL, 1 + random() % (added + 1)));
+            break;
+        }
+    }
+
+    actions.push_back(TestersAction(ta::SLEEP, 10000));
+
+    return actions;
+}
+
+void stress(unsigned seeds)
+{
+    unsigned failed = 0;
+
+    for (unsigned seed = 1; seed <= seeds; ++seed)
+    {
+        auto actions = random_test_case(seed);
+
+        auto first = run_test_case(actions);
+        auto second = run_test_case(actions);
+
+        // a task is reported at most once, and never after it was killed
+        map<ThreadPool::TaskId, set<tpa>> seen;
+
+        bool passed = first == second;
+
+        for (const auto& event : first)
+        {
+            auto& actions = seen[event.task_id];
+
+            passed = passed && !(event.action == tpa::RETURN_RESULT && (actions.count(tpa::RETURN_RESULT) > 0 || actions.count(tpa::KILL_TASK) > 0));
+
+            actions.insert(event.action);
+        }
+
+        if (!passed)
+        {
+            cout << "Failed stress, seed " << seed << "\n";
+
+            ++failed;
+        }
+    }
+
+    cout << (failed == 0 ? "stress#1 passed\n" : "Failed stress#1\n");
+}
+
+void stress_tests()
+{
+    stress(50);
+}
+
+void command_reader_tests()
+{
+    // crlf, a line longer than the whole buffer, junk, spaces and a last line without a newline;
+    // a 20 byte buffer splits most lines across reads
+    const char* input = "add 3\nkill 4294967297\r\nadd 123456789012345678901234567890\nhello\nadd\nkill x\nadd  12\nexit\nadd 7";
+
+    const char* name = "command_reader.txt";
+
+    {
+        ofstream out(name, ios::binary);
+
+        out << input;
+    }
+
+    FILE* file = fopen(name, "rb");
+
+    CommandReader reader(fileno(file), 20);
+
+    vector<Command> commands;
+
+    Command chunk[2];
+
+    while (size_t n = reader.read(chunk, 2))
+    {
+        commands.insert(commands.end(), chunk, chunk + n);
+    }
+
+    fclose(file);
+
+    bool passed = commands.size() == 5
+        && commands[0].kind == Command::ADD && commands[0].value == 3
+        && commands[1].kind == Command::KILL && commands[1].value == 4294967297ull
+        && commands[2].kind == Command::ADD && commands[2].value == 12
+        && commands[3].kind == Command::EXIT
+        && commands[4].kind == Command::ADD && commands[4].value == 7;
+
+    cout << (passed ? "command reader#1 passed\n" : "Failed command reader#1\n");
+
+    // a number has to be all there is after the command, trailing spaces aside
+    {
+        ofstream out(name, ios::binary);
+
+        out << "add 12abc\nadd 5  \nkill 3 4\nkill 9x\nexit now\nadd 4294967297\nadd 6\r\n";
+    }
+
+    file = fopen(name, "rb");
+
+    CommandReader strict(fileno(file));
+
+    commands.clear();
+
+    while (size_t n = strict.read(chunk, 2))
+    {
+        commands.insert(commands.end(), chunk, chunk + n);
+    }
+
+    fclose(file);
+
+    remove(name);
+
+    passed = commands.size() == 2
+        && commands[0].kind == Command::ADD && commands[0].value == 5
+        && commands[1].kind == Command::ADD && commands[1].value == 6;
+
+    cout << (passed ? "command reader#2 passed\n" : "Failed command reader#2\n");
+}
+
+#ifdef __linux__
+
+// blocking test client for the server, reads and writes whole frames
+struct ServerClient
+{
+    int fd;
+
+    ServerClient(const string& path)
+    {
+        sockaddr_un address = {};
+
+        address.sun_family = AF_UNIX;
+
+        strcpy(address.sun_path, path.c_str());
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        timeval timeout = { 5, 0 };
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        connect(fd, (sockaddr*)&address, sizeof(address));
+    }
+
+    ~ServerClient()
+    {
+        close(fd);
+    }
+
+    void send(Server::FrameT type, unsigned long long value, int extra = -1)
+    {
+        string frame;
+
+        unsigned size = 1 + 8 + (extra >= 0 ? 4 : 0);
+
+        for (int i = 0; i < 4; ++i) frame += (char)(size >> (8 * i));
+
+        frame += (char)type;
+
+        for (int i = 0; i < 8; ++i) frame += (char)(value >> (8 * i));
+
+        if (extra >= 0)
+        {
+            for (int i = 0; i < 4; ++i) frame += (char)((unsigned)extra >> (8 * i));
+        }
+
+        ::send(fd, frame.data(), frame.size(), 0);
+    }
+
+    // type and first field, 0 type on timeout
+    pair<int, unsigned long long> receive()
+    {
+        unsigned char header[4];
+
+        if (recv(fd, header, 4, MSG_WAITALL) != 4)
+        {
+            return { 0, 0 };
+        }
+
+        unsigned size = header[0] | header[1] << 8 | header[2] << 16 | header[3] << 24;
+
+        vector<unsigned char> body(size);
+
+        if (size < 9 || recv(fd, body.data(), size, MSG_WAITALL) != (ssize_t)size)
+        {
+            return { 0, 0 };
+        }
+
+        unsigned long long value = 0;
+
+        for (int i = 0; i < 8; ++i) value |= (unsigned long long)body[1 + i] << (8 * i);
+
+        // ADDED carries the task id second, that's what the tests check against
+        if (body[0] == Server::ADDED)
+        {
+            value = 0;
+
+            for (int i = 0; i < 8; ++i) value |= (unsigned long long)body[9 + i] << (8 * i);
+        }
+
+        return { body[0], value };
+    }
+};
+
+void server_tests()
+{
+    ThreadPool pool(2, 1);
+
+    string path = "server_tests.sock";
+
+    Server server(pool, path);
+
+    bool passed = server.listen();
+
+    boost::thread loop([&server] { server.run(); });
+
+    {
+        // two producers at once, each hears back about its own tasks and nothing else
+        ServerClient first(path), second(path);
+
+        for (int i = 0; i < 20; ++i)
+        {
+            (i % 2 == 0 ? first : second).send(Server::ADD, i, 0);
+        }
+
+        for (auto client : { &first, &second })
+        {
+            set<unsigned long long> added, reported;
+
+            for (int i = 0; i < 20; ++i)
+            {
+                auto frame = client->receive();
+
+                (frame.first == Server::ADDED ? added : reported).insert(frame.second);
+
+                passed = passed && (frame.first == Server::ADDED || frame.first == Server::RESULT);
+            }
+
+            passed = passed && added.size() == 10 && added == reported;
+        }
+
+        // a long task killed by id: it's never reported, the pool counts it killed
+        first.send(Server::ADD, 100, 60);
+
+        auto id = first.receive();
+
+        first.send(Server::KILL, id.second);
+
+        for (int i = 0; i < 100 && pool.stats().killed == 0; ++i)
+        {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        }
+
+        passed = passed && id.first == Server::ADDED && pool.stats().killed == 1;
+    }
+
+    cout << (passed ? "server#1 passed\n" : "Failed server#1\n");
+
+    {
+        // done sending straight after the adds, the results still come and then the server hangs up;
+        // a kill from another client doesn't reach those tasks
+        ServerClient client(path), other(path);
+
+        for (int i = 0; i < 3; ++i)
+        {
+            client.send(Server::ADD, i, 1);
+        }
+
+        shutdown(client.fd, SHUT_WR);
+
+        set<unsigned long long> added, reported;
+
+        for (int i = 0; i < 6; ++i)
+        {
+            auto frame = client.receive();
+
+            if (frame.first == Server::ADDED)
+            {
+                added.insert(frame.second);
+
+                other.send(Server::KILL, frame.second);
+            }
+            else if (frame.first == Server::RESULT)
+            {
+                reported.insert(frame.second);
+            }
+        }
+
+        passed = added.size() == 3 && added == reported && client.receive().first == 0 && pool.stats().killed == 1;
+    }
+
+    server.stop();
+
+    loop.join();
+
+    cout << (passed ? "server#2 passed\n" : "Failed server#2\n");
+}
+
+#endif
+
+void kill_tasks_tests()
+{
+    vector<TestCase> tests;
+
+    START_TESTCASE_DESCRIPTION;
+    actions
+        .push_back(TestersAction(1, 1, "kill_tasks_1"))
+        .push_back(TestersAction(ta::ADD, 3))
+        .push_back(TestersAction(ta::SLEEP, 300))
+        .push_back(TestersAction(ta::KILL, 1))
+    ;
+
+    expected
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_HOT_THREAD, 1))
+        .push_back(ThreadPoolsAction(tpa::KILL_TASK, 1))
+    ;
+    END_TESTCASE_DESCRIPTION;
+
+    START_TESTCASE_DESCRIPTION;
+    actions
+        .push_back(TestersAction(0, 1, "kill_tasks_1"))
+        .push_back(TestersAction(ta::ADD, 3))
+        .push_back(TestersAction(ta::SLEEP, 300))
+        .push_back(TestersAction(ta::KILL, 1))
+        .push_back(TestersAction(ta::SLEEP, 10000))
+    ;
+
+    expected
+        .push_back(ThreadPoolsAction(tpa::CREATE_FREE_THREAD, 1))
+        .push_back(ThreadPoolsAction(tpa::KILL_TASK, 1))
+        .push_back(ThreadPoolsAction(tpa::TERMINATE_FREE_THREAD, 1))
+    ;
+    END_TESTCASE_DESCRIPTION;
+
+    START_TESTCASE_DESCRIPTION;
+    actions
+        .push_back(TestersAction(1, 1, "kill_tasks_3"))
+        .push_back(TestersAction(ta::ADD, 1))
+        .push_back(TestersAction(ta::SLEEP, 1250))
+        .push_back(TestersAction(ta::KILL, 1)) // already finished
+        .push_back(TestersAction(ta::KILL, 42)) // never existed
+    ;
+
+    expected
+        .push_back(ThreadPoolsAction(tpa::ASSIGN_TO_HOT_THREAD, 1))
+        .push_back(ThreadPoolsAction(tpa::RETURN_RESULT, 1))
+    ;
+    END_TESTCASE_DESCRIPTION;
+
+    run_tests(tests, "kill tasks");
+}
+
+#endif
+
+int main(int argc, char** argv)
+{
+#ifndef TESTING
+
+    int N = boost::lexical_cast<int>(argv[1]);
+    int T = boost::lexical_cast<int>(argv[2]);
+
+    ThreadPool pool(N, T);
+
+    CommandReader reader(0);
+
+#ifdef __linux__
+    if (argc > 3)
+    {
+        // shared pool for local producers on the socket at argv[3]; stdin only says when to stop
+        Server server(pool, argv[3]);
+
+        if (!server.listen())
+        {
+            cerr << "can't listen on " << argv[3] << endl;
+
+            return 1;
+        }
+
+        boost::thread watcher([&reader, &server] {
+            Command command;
+
+            while (reader.read(&command, 1) == 1 && command.kind != Command::EXIT)
+            {
+            }
+
+            server.stop();
+        });
+
+        server.run();
+
+        watcher.join();
+
+        return 0;
+    }
+#endif
+
+    Command commands[256];
+
+    // adds in a row go in as one batch; a kill flushes the adds before it, it may well be aimed at one of them
+    vector<Timer> batch;
+
+    auto flush = [&pool, &batch] {
+        if (!batch.empty())
+        {
+            try
+            {
+                pool.addTasks(batch.begin(), batch.end());
+            }
+            catch (const length_error&)
+            {
+                cerr << "pool is full, " << batch.size() << " adds dropped" << endl;
+            }
+
+            batch.clear();
+        }
+    };
+
+    bool running = true;
+
+    while (running)
+    {
+        size_t n = reader.read(commands, sizeof(commands) / sizeof(commands[0]));
+
+        if (n == 0)
+        {
+            break; // end of input
+        }
+
+        for (size_t i = 0; i < n && running; ++i)
+        {
+            switch (commands[i].kind)
+            {
+            case Command::ADD:
+                batch.push_back(Timer((unsigned)commands[i].value));
+
+                break;
+
+            case Command::KILL:
+                flush();
+
+                pool.killTask(commands[i].value);
+
+                break;
+
+            case Command::EXIT:
+                running = false;
+
+                break;
+            }
+        }
+
+        flush();
+    }
+
+    if (running)
+    {
+        // end of input is no stop: what was added still runs and reports, only exit drops it
+        while (true)
+        {
+            auto stats = pool.stats();
+
+            if (stats.completed + stats.killed >= stats.submitted)
+            {
+                break;
+            }
+
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+        }
+    }
+
+#else
+
+    // "stress N" replays N random seeds instead of running the suites
+    if (argc > 2 && string(argv[1]) == "stress")
+    {
+        stress(boost::lexical_cast<unsigned>(argv[2]));
+
+        return 0;
+    }
+
+    vector<test> tests = {
+        hot_threads_tests,
+        free_threads_tests,
+        kill_tasks_tests,
+        elastic_policy_tests,
+        work_stealing_tests,
+        typed_tasks_tests,
+        allocations_tests,
+        batch_tests,
+        priorities_tests,
+        graph_tests,
+        group_tests,
+        parallel_tests,
+        timer_tests,
+        result_sink_tests,
+        tracer_tests,
+        stats_tests,
+        placement_tests,
+        idle_tests,
+        cancellation_tests,
+        stress_tests,
+        command_reader_tests,
+#ifdef __linux__
+        server_tests,
+#endif
+#ifdef COROUTINES
+        coroutine_tests,
+#endif
     };
 
     for_each(tests.begin(), tests.end(), [](test f) { f(); });